@@ -0,0 +1,15 @@
+#!/usr/bin/env sh
+
+set -xeu
+
+FLAGS="-O2 -std=c++20 -fwrapv -fno-exceptions -fno-strict-aliasing -Wall -Wextra -static-libgcc -pthread"
+
+clang++ $FLAGS -mavx2 -o bench_lexer_avx2.exe bench_lexer.cpp kielo.cpp core/core.cpp
+clang++ $FLAGS -o bench_lexer.exe bench_lexer.cpp kielo.cpp core/core.cpp
+clang++ $FLAGS -DKIELO_LEXER_DFA -o bench_lexer_dfa.exe bench_lexer.cpp kielo.cpp core/core.cpp
+clang++ $FLAGS -DKIELO_DISABLE_ASCII_FAST_PATH -DKIELO_DISABLE_SIMD -DKIELO_DISABLE_SWAR -DCORE_DISABLE_SIMD -o bench_lexer_baseline.exe bench_lexer.cpp kielo.cpp core/core.cpp
+
+./bench_lexer_baseline.exe "$@"
+./bench_lexer.exe "$@"
+./bench_lexer_dfa.exe "$@"
+./bench_lexer_avx2.exe "$@"
@@ -0,0 +1,1527 @@
+#include "core/core.hpp"
+#include "core/memory.hpp"
+#include "core/dynamic_array.hpp"
+#include "core/thread.hpp"
+#include "core/file.hpp"
+#include "core/stream.hpp"
+
+#include "lexer.hpp"
+#include "parser.hpp"
+
+#include <time.h>
+#include <stdlib.h>
+
+#if defined(_M_X64)
+	#include <intrin.h>
+#elif defined(__x86_64__)
+	#include <x86intrin.h>
+#endif
+
+using namespace core;
+using namespace kielo;
+
+static
+f64 time_now(){
+	timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return f64(ts.tv_sec) + f64(ts.tv_nsec) * 1e-9;
+}
+
+// Build a source of at least `size` bytes by repeating a small snippet
+static
+String make_corpus(Allocator* allocator, isize size){
+	String snippet =
+		"fn compute_value(arg_a, arg_b) {\n"
+		"\tlet result = arg_a + arg_b * counter; // accumulate into result\n"
+		"\tif result >= limit && !done { return result << shift; }\n"
+		"\tresult -= arg_b; result |= mask_bits;\n"
+		"}\n";
+
+	isize count = (size + snippet.len() - 1) / snippet.len();
+	auto buf = allocator->make<byte>(count * snippet.len());
+	ensure(buf.len() > 0, "Failed to allocate corpus");
+
+	for(isize i = 0; i < count; i += 1){
+		mem_copy_no_overlap(buf.data() + i * snippet.len(), snippet.data(), snippet.len());
+	}
+	return String::from_bytes(buf);
+}
+
+// Same as make_corpus, but with a snippet that exercises every part of the
+// parser
+static
+String make_program_corpus(Allocator* allocator, isize size){
+	String snippet =
+		"struct Particle {\n"
+		"\tposition: [3]f32,\n"
+		"\tvelocity: ^Vector,\n"
+		"\ttags: []u8,\n"
+		"}\n"
+		"fn update_particle(p: ^Particle, dt: f32, count: i32) -> i32 {\n"
+		"\tlet speed: f32 = p^.velocity^.x * dt + p^.position[0]; // integrate\n"
+		"\tif speed >= limit && !p^.frozen { p^.position[1] += speed * 0.5; } else { speed = -speed; }\n"
+		"\tfor i < count { total = total + weights[i] * scale(i, speed, 3); i += 1; }\n"
+		"\tmatch mode { 0 -> { break; }, 1 -> reset(p), _ -> speed }\n"
+		"\treturn (count << 2) | flags & mask;\n"
+		"}\n"
+		"const max_particles: i32 = 4096;\n";
+
+	isize count = (size + snippet.len() - 1) / snippet.len();
+	auto buf = allocator->make<byte>(count * snippet.len());
+	ensure(buf.len() > 0, "Failed to allocate corpus");
+
+	for(isize i = 0; i < count; i += 1){
+		mem_copy_no_overlap(buf.data() + i * snippet.len(), snippet.data(), snippet.len());
+	}
+	return String::from_bytes(buf);
+}
+
+// Space separated integer literals cycling through all four bases, values
+// come from a fixed seed so runs are comparable
+static
+String make_integer_corpus(Allocator* allocator, isize count){
+	constexpr isize max_literal_size = 40;
+	auto buf = allocator->make<byte>(count * max_literal_size);
+	ensure(buf.len() > 0, "Failed to allocate corpus");
+
+	constexpr char const* prefixes[] = {"", "0x", "0b", "0o"};
+	constexpr u64 bases[] = {10, 16, 2, 8};
+
+	u64 state = 0x2545'f491'4f6c'dd1d;
+	isize n = 0;
+	for(isize i = 0; i < count; i += 1){
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		u64 value = state >> 33;
+		u64 base = bases[i % 4];
+
+		for(char const* p = prefixes[i % 4]; *p; p += 1){
+			buf[n++] = byte(*p);
+		}
+
+		byte digits[64];
+		isize len = 0;
+		do {
+			digits[len++] = byte("0123456789abcdef"[value % base]);
+			value /= base;
+		} while(value > 0);
+
+		while(len > 0){
+			buf[n++] = digits[--len];
+		}
+		buf[n++] = ' ';
+	}
+
+	return String::from_bytes(buf[{0, n}]);
+}
+
+// Space separated decimal literals with a fraction and an exponent, shaped
+// like the output of printf("%.17g")
+static
+String make_real_corpus(Allocator* allocator, isize count){
+	constexpr isize max_literal_size = 32;
+	auto buf = allocator->make<byte>(count * max_literal_size);
+	ensure(buf.len() > 0, "Failed to allocate corpus");
+
+	u64 state = 0x9e37'79b9'7f4a'7c15;
+	isize n = 0;
+	for(isize i = 0; i < count; i += 1){
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		u64 bits = state >> 7;
+
+		buf[n++] = byte('1' + bits % 9);
+		buf[n++] = '.';
+		for(isize d = 0; d < 16; d += 1){
+			bits = bits * 10 + (state >> 40);
+			buf[n++] = byte('0' + (bits >> 20) % 10);
+		}
+
+		i64 exponent = i64((state >> 13) % 601) - 300;
+		buf[n++] = 'e';
+		if(exponent < 0){
+			buf[n++] = '-';
+			exponent = -exponent;
+		}
+		if(exponent >= 100){ buf[n++] = byte('0' + exponent / 100); }
+		if(exponent >= 10){ buf[n++] = byte('0' + (exponent / 10) % 10); }
+		buf[n++] = byte('0' + exponent % 10);
+		buf[n++] = ' ';
+	}
+
+	return String::from_bytes(buf[{0, n}]);
+}
+
+// Config style source: one long string literal per line, every eighth one
+// has escapes so both the zero-copy and the decoding path are measured
+static
+String make_string_corpus(Allocator* allocator, isize count){
+	String plain   = "entry = \"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor\";\n";
+	String escaped = "entry = \"Lorem ipsum\\tdolor sit amet,\\n consectetur \\\"adipiscing\\\" elit\\u{2026}\";\n";
+
+	auto buf = allocator->make<byte>(count * max(plain.len(), escaped.len()));
+	ensure(buf.len() > 0, "Failed to allocate corpus");
+
+	isize n = 0;
+	for(isize i = 0; i < count; i += 1){
+		String line = (i % 8 == 7) ? escaped : plain;
+		mem_copy_no_overlap(buf.data() + n, line.data(), line.len());
+		n += line.len();
+	}
+	return String::from_bytes(buf[{0, n}]);
+}
+
+//// Equality checks
+template<typename T>
+static
+bool same_column(Slice<T> a, Slice<T> b){
+	return a.len() == b.len() && (a.len() == 0 || mem_compare(a.data(), b.data(), a.len() * sizeof(T)) == 0);
+}
+
+// Through the accessors, a relexed stream keeps its columns around a gap
+static
+bool same_stream(TokenStream const& a, TokenStream const& b){
+	bool trivia = a.trivia_starts.len() > 0;
+	if(a.count != b.count || trivia != (b.trivia_starts.len() > 0)){
+		return false;
+	}
+	for(isize i = 0; i < a.count; i += 1){
+		if(a.type(i) != b.type(i) || a.offset(i) != b.offset(i)){ return false; }
+		if(trivia && a.trivia_start(i) != b.trivia_start(i)){ return false; }
+	}
+	return true;
+}
+
+static
+bool same_ast(Ast const& a, Ast const& b){
+	return a.count == b.count && a.extra_count == b.extra_count && a.root_count == b.root_count
+		&& same_column(a.kinds[{0, a.count}], b.kinds[{0, b.count}])
+		&& same_column(a.main_tokens[{0, a.count}], b.main_tokens[{0, b.count}])
+		&& same_column(a.data[{0, a.count}], b.data[{0, b.count}])
+		&& same_column(a.extra[{0, a.extra_count}], b.extra[{0, b.extra_count}])
+		&& same_column(a.declarations(), b.declarations());
+}
+
+// Every token position from LineIndex and TokenStream against counting lines
+// and codepoints from the start of `source`
+static
+void check_positions(Arena* arena, String source){
+	auto region = ArenaRegion::create(arena);
+	auto stream = tokenize_all(arena, source).unwrap();
+	auto lines = LineIndex::create(arena, source);
+
+	auto lex = Lexer::create(source);
+	isize at = 0;
+	i64 line = 1, column = 1;
+	for(isize i = 0; i < stream.count; i += 1){
+		auto token = lex.next().unwrap();
+		ensure(token.start == stream.offset(i), "Token start differs from the token stream");
+
+		for(; at < token.start; at += 1){
+			byte c = source[at];
+			if(c == '\n'){
+				line += 1;
+				column = 1;
+			}
+			else if(!utf8_is_continuation_byte(c)){
+				column += 1;
+			}
+		}
+
+		Position p = lines.position(token);
+		ensure(p.line == line && p.column == column, "Token position differs from counting lines");
+		p = stream.position(i);
+		ensure(p.line == line && p.column == column, "Token stream position differs from counting lines");
+	}
+	region.release();
+}
+
+// Lexes `source` through a ByteBufferStream and a window of `window_size`
+// bytes, every token must be the one tokenize_all finds at the same offset.
+// The window is widened when a token other than trivia would not fit in it
+// with a codepoint after it.
+// In TriviaMode::Tokens trivia longer than the window comes in pieces, the
+// pieces after the first one are checked to follow it and then skipped.
+static
+void check_stream_lexer(Arena* arena, String source, TriviaMode trivia, isize window_size){
+	auto region = ArenaRegion::create(arena);
+	auto stream = tokenize_all(arena, source, trivia).unwrap();
+
+	for(isize i = 0; i < stream.count; i += 1){
+		TokenType type = stream.type(i);
+		if(type != TokenType::Whitespace && type != TokenType::LineComment){
+			window_size = max(window_size, isize(stream.length(i)) + 4);
+		}
+	}
+	auto window = arena->make<byte>(window_size);
+	ensure(window.len() == window_size, "Failed to allocate stream window");
+
+	auto input = ByteBufferStream::from(source.raw_bytes());
+	auto lex = StreamLexer::create(&input, window);
+	lex.lexer.trivia = trivia;
+
+	isize i = 0;
+	i64 previous_end = 0;
+	for(;;){
+		auto res = lex.next();
+		ensure(res.ok(), "Stream lexer error");
+		auto token = res.unwrap();
+
+		ensure(token.offset <= source.len() && token.start + token.lexeme.len() <= token.offset, "Streamed token is out of bounds");
+		ensure(mem_compare(token.lexeme.data(), source.data() + token.start, token.lexeme.len()) == 0, "Streamed lexeme differs from the source");
+		ensure(utf8_valid_prefix(token.lexeme.raw_bytes()) == token.lexeme.len(), "Streamed lexeme splits a codepoint");
+
+		bool piece = i > 0 && (i == stream.count || token.start < stream.offset(i));
+		if(piece){
+			ensure(token.type == stream.type(i - 1) && token.start == previous_end, "Stream lexer split a token other than trivia");
+		}
+		else {
+			ensure(i < stream.count && token.type == stream.type(i) && token.start == stream.offset(i), "Stream lexer differs from tokenize_all");
+			ensure(trivia != TriviaMode::Skip || token.trivia_start == stream.trivia_start(i), "Streamed trivia start differs from tokenize_all");
+			i += 1;
+		}
+		previous_end = token.offset;
+		if(token.type == TokenType::EndOfFile){ break; }
+	}
+	ensure(i == stream.count, "Stream lexer stopped early");
+	region.release();
+}
+
+//// Pointer based syntax tree
+// The usual alternative to the flat AST, kept here to compare against: one
+// allocation per node, children behind pointers and nodes with more than
+// two children holding a separately allocated array of them.
+struct PointerNode {
+	NodeKind kind;
+	u32      token;
+	union {
+		struct { PointerNode* lhs; PointerNode* rhs; } pair;
+		struct { PointerNode** items; isize count; } list;
+	};
+};
+
+struct PointerTree {
+	PointerNode* root;
+	isize        nodes;
+	isize        bytes; /* Without allocator overhead */
+};
+
+static inline
+bool has_child_list(NodeKind k){
+	using K = NodeKind;
+	switch(k){
+		case K::Root: case K::Block: case K::StructDecl:
+		case K::FnDecl: case K::If: case K::Call: case K::Match:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Call f on every child of node i, in source order, empty slots are skipped.
+// Along with each child f gets the declaration it is part of, `decl` for all
+// but the children of the root.
+template<typename F>
+void for_each_child(Ast const& ast, Declaration decl, NodeIndex i, F&& f){
+	using K = NodeKind;
+	NodeData d = ast.children(i);
+
+	switch(ast.kind(i)){
+		case K::Root:
+			for(Declaration child : ast.declarations()){ f(child, child.node); }
+			break;
+
+		case K::Block: case K::StructDecl:
+			for(u32 child : ast.list(d.lhs, d.rhs)){ f(decl, child); }
+			break;
+
+		case K::FnDecl:
+			for(u32 param : ast.list(ast.extra[d.lhs], ast.extra[d.lhs + 1])){ f(decl, param); }
+			if(ast.extra[d.lhs + 2]){ f(decl, ast.extra[d.lhs + 2]); }
+			f(decl, d.rhs);
+			break;
+
+		case K::If:
+			f(decl, d.lhs);
+			f(decl, ast.extra[d.rhs]);
+			if(ast.extra[d.rhs + 1]){ f(decl, ast.extra[d.rhs + 1]); }
+			break;
+
+		case K::Call: case K::Match:
+			f(decl, d.lhs);
+			for(u32 child : ast.list(ast.extra[d.rhs], ast.extra[d.rhs + 1])){ f(decl, child); }
+			break;
+
+		default:
+			if(d.lhs){ f(decl, d.lhs); }
+			if(d.rhs){ f(decl, d.rhs); }
+			break;
+	}
+}
+
+static
+PointerNode* to_pointer_tree(PointerTree* tree, Ast const& ast, Declaration decl, NodeIndex i){
+	auto node = heap_allocator()->make<PointerNode>();
+	ensure(node != nullptr, "Failed to allocate pointer node");
+	node->kind  = ast.kind(i);
+	node->token = ast.main_token(decl, i);
+	tree->nodes += 1;
+	tree->bytes += sizeof(PointerNode);
+
+	if(has_child_list(node->kind)){
+		isize count = 0;
+		for_each_child(ast, decl, i, [&](Declaration, NodeIndex){ count += 1; });
+
+		node->list.items = count > 0 ? heap_allocator()->make<PointerNode*>(count).data() : nullptr;
+		node->list.count = count;
+		tree->bytes += count * sizeof(PointerNode*);
+
+		isize n = 0;
+		for_each_child(ast, decl, i, [&](Declaration child_decl, NodeIndex child){
+			node->list.items[n] = to_pointer_tree(tree, ast, child_decl, child);
+			n += 1;
+		});
+	}
+	else {
+		NodeData d = ast.children(i);
+		node->pair.lhs = d.lhs ? to_pointer_tree(tree, ast, decl, d.lhs) : nullptr;
+		node->pair.rhs = d.rhs ? to_pointer_tree(tree, ast, decl, d.rhs) : nullptr;
+	}
+	return node;
+}
+
+static
+void free_pointer_tree(PointerNode* node){
+	if(node == nullptr){ return; }
+	if(has_child_list(node->kind)){
+		for(isize k = 0; k < node->list.count; k += 1){
+			free_pointer_tree(node->list.items[k]);
+		}
+		if(node->list.count > 0){
+			heap_allocator()->drop(Slice(node->list.items, node->list.count));
+		}
+	}
+	else {
+		free_pointer_tree(node->pair.lhs);
+		free_pointer_tree(node->pair.rhs);
+	}
+	heap_allocator()->drop(node);
+}
+
+// Depth first walks that touch every node, for the traversal comparison
+static
+u64 walk_ast(Ast const& ast, Declaration decl, NodeIndex i){
+	u64 sum = ast.main_token(decl, i);
+	for_each_child(ast, decl, i, [&](Declaration child_decl, NodeIndex child){ sum += walk_ast(ast, child_decl, child); });
+	return sum;
+}
+
+// Kind, main token and shape of every node in preorder, the same for trees
+// that only differ in where their nodes are stored
+static
+void flatten_tree(Ast const& ast, Declaration decl, NodeIndex i, DynamicArray<u32>* out){
+	isize children = 0;
+	for_each_child(ast, decl, i, [&](Declaration, NodeIndex){ children += 1; });
+
+	NodeData d = ast.children(i);
+	u32 slots = has_child_list(ast.kind(i)) ? 0 : u32(d.lhs != 0) | u32(d.rhs != 0) << 1;
+	out->append(u32(ast.kind(i)));
+	out->append(ast.main_token(decl, i));
+	out->append(u32(children) << 2 | slots);
+	for_each_child(ast, decl, i, [&](Declaration child_decl, NodeIndex child){ flatten_tree(ast, child_decl, child, out); });
+}
+
+static
+bool same_tree(Ast const& a, Ast const& b){
+	auto flat_a = DynamicArray<u32>::create(heap_allocator(), a.count * 3);
+	auto flat_b = DynamicArray<u32>::create(heap_allocator(), b.count * 3);
+	flatten_tree(a, Declaration{}, 0, &flat_a);
+	flatten_tree(b, Declaration{}, 0, &flat_b);
+	return flat_a.len() == flat_b.len() && mem_compare(flat_a.data(), flat_b.data(), flat_a.len() * sizeof(u32)) == 0;
+}
+
+static
+u64 walk_pointer_tree(PointerNode const* node){
+	if(node == nullptr){ return 0; }
+	u64 sum = node->token;
+	if(has_child_list(node->kind)){
+		for(isize k = 0; k < node->list.count; k += 1){
+			sum += walk_pointer_tree(node->list.items[k]);
+		}
+	}
+	else {
+		sum += walk_pointer_tree(node->pair.lhs);
+		sum += walk_pointer_tree(node->pair.rhs);
+	}
+	return sum;
+}
+
+// Parse `source` with recovery, it must report one error and leave exactly the
+// declarations in `expected` in the root list
+static
+void check_recovery(Arena* arena, String source, Slice<NodeKind> expected){
+	auto region = ArenaRegion::create(arena);
+	auto stream = tokenize_all(arena, source, TriviaMode::Skip).unwrap();
+	auto errors = ErrorList::create(arena);
+	auto res = parse(arena, &stream, &errors);
+	ensure(res.ok(), "Recovering parse failed");
+
+	Ast ast = res.unwrap();
+	auto declarations = ast.declarations();
+	ensure(errors.count == 1, "Recovery reported the wrong number of errors");
+	ensure(declarations.len() == expected.len(), "Recovery skipped or added declarations");
+	for(isize i = 0; i < expected.len(); i += 1){
+		ensure(ast.kind(declarations[i].node) == expected[i], "Recovery resumed at the wrong declaration");
+	}
+	region.release();
+}
+
+// A token the lexer rejects, with the error it reports and the offset of the
+// error from the start of the token
+struct BadToken {
+	String    text;
+	ErrorType error;
+	isize     at;
+};
+
+// Lex, in one recovering pass, a source where each bad token replaces the `x`
+// of one line of a clean source. Every bad token must come back as a single
+// Unknown token with its error at the right offset, and every other token as
+// the clean one shifted by the size change. Checked through tokenize_all, a
+// Lexer with `errors`, a Lexer whose caller synchronizes after each error, and
+// relex of each bad token into the clean source.
+static
+void check_lexer_recovery(Arena* arena, Slice<BadToken> bad, TriviaMode trivia){
+	auto region = ArenaRegion::create(arena);
+
+	String line = "\tf(x, 1); // c\n";
+	constexpr isize x_offset = 3;
+
+	isize broken_len = 0;
+	for(BadToken const& b : bad){
+		broken_len += line.len() - 1 + b.text.len();
+	}
+	auto clean_buf = arena->make<byte>(line.len() * bad.len());
+	auto broken_buf = arena->make<byte>(broken_len);
+	ensure(clean_buf.len() > 0 && broken_buf.len() == broken_len, "Failed to allocate sources");
+
+	isize n = 0;
+	for(isize k = 0; k < bad.len(); k += 1){
+		mem_copy_no_overlap(clean_buf.data() + k * line.len(), line.data(), line.len());
+		mem_copy_no_overlap(broken_buf.data() + n, line.data(), x_offset);
+		n += x_offset;
+		mem_copy_no_overlap(broken_buf.data() + n, bad[k].text.data(), bad[k].text.len());
+		n += bad[k].text.len();
+		mem_copy_no_overlap(broken_buf.data() + n, line.data() + x_offset + 1, line.len() - x_offset - 1);
+		n += line.len() - x_offset - 1;
+	}
+
+	auto clean = tokenize_all(arena, String::from_bytes(clean_buf), trivia).unwrap();
+	auto errors = ErrorList::create(arena);
+	auto broken = tokenize_all(arena, String::from_bytes(broken_buf), trivia, &errors).unwrap();
+	ensure(errors.count == bad.len() && broken.count == clean.count, "Recovering lexer lost or added tokens");
+
+	isize k = 0;
+	i64 shift = 0;
+	for(isize i = 0; i < clean.count; i += 1){
+		if(clean.type(i) == TokenType::Identifier && clean_buf[clean.offset(i)] == 'x'){
+			Error e = errors.errors()[k];
+			ensure(broken.type(i) == TokenType::Unknown && broken.offset(i) == clean.offset(i) + shift && broken.length(i) == bad[k].text.len(), "Bad token is not a single Unknown token");
+			ensure(e.type == bad[k].error && e.offset == broken.offset(i) + bad[k].at, "Lexer error reported at the wrong offset");
+			shift += bad[k].text.len() - 1;
+			k += 1;
+		}
+		else {
+			ensure(broken.type(i) == clean.type(i) && broken.offset(i) == clean.offset(i) + shift, "Recovering lexer differs from the clean source");
+		}
+	}
+
+	// The same pass through a Lexer, once recording the errors itself and
+	// once returning them to a caller that synchronizes
+	auto recorded = ErrorList::create(arena);
+	auto lex = Lexer::create(String::from_bytes(broken_buf));
+	lex.trivia = trivia;
+	lex.errors = &recorded;
+	auto manual = Lexer::create(String::from_bytes(broken_buf));
+	manual.trivia = trivia;
+
+	isize found = 0;
+	for(isize i = 0; i < broken.count; i += 1){
+		auto token = lex.next().unwrap();
+		ensure(token.type == broken.type(i) && token.start == broken.offset(i), "Lexer with errors differs from tokenize_all");
+
+		auto res = manual.next();
+		if(res.ok()){
+			token = res.unwrap();
+		}
+		else {
+			Error e = res.unwrap_error();
+			ensure(found < errors.count && e.type == errors.errors()[found].type && e.offset == errors.errors()[found].offset, "Lexer returned a different error");
+			ensure(manual.synchronize(e), "Lexer did not synchronize after an error");
+			token = manual.make_token(TokenType::Unknown);
+			found += 1;
+		}
+		ensure(token.type == broken.type(i) && token.start == broken.offset(i), "Synchronized lexer differs from tokenize_all");
+	}
+	ensure(found == errors.count && recorded.count == errors.count, "Lexer reported a different number of errors");
+	for(isize e = 0; e < errors.count; e += 1){
+		ensure(recorded.errors()[e].type == errors.errors()[e].type && recorded.errors()[e].offset == errors.errors()[e].offset, "Lexer recorded a different error");
+	}
+
+	// Each bad token typed into the clean source on its own and taken out
+	// again, editing the clean stream in place
+	for(isize k = 0; k < bad.len(); k += 1){
+		TextEdit edit;
+		edit.offset   = k * line.len() + x_offset;
+		edit.removed  = 1;
+		edit.inserted = bad[k].text.raw_bytes();
+
+		auto edit_errors = ErrorList::create(arena);
+		relex(&clean, edit, &edit_errors).unwrap();
+		ensure(edit_errors.count == 1 && edit_errors.errors()[0].type == bad[k].error && edit_errors.errors()[0].offset == edit.offset + bad[k].at, "relex reported the error at the wrong offset");
+
+		auto fresh_errors = ErrorList::create(arena);
+		auto fresh = tokenize_all(arena, clean.text(), trivia, &fresh_errors).unwrap();
+		ensure(same_stream(clean, fresh), "Relexed stream with errors differs from lexing the edited source");
+
+		edit.removed  = bad[k].text.len();
+		edit.inserted = String("x").raw_bytes();
+		relex(&clean, edit).unwrap();
+	}
+	auto original = tokenize_all(arena, String::from_bytes(clean_buf), trivia).unwrap();
+	ensure(same_stream(clean, original), "Undoing the edits did not give back the clean stream");
+	region.release();
+}
+
+//// Synthetic corpora
+// Seeded generators for valid kielo source with a controlled token mix, the
+// same seed and size always give the same bytes.
+enum class CorpusMix : u8 {
+	Identifiers, /* Declarations and calls, long names */
+	Operators,   /* Every punctuator, one letter operands */
+	Comments,    /* Mostly line comments */
+	Numeric,     /* Integers in all bases and reals */
+	NonAscii,    /* Unicode identifiers, strings and comments */
+};
+
+constexpr CorpusMix corpus_mixes[] = {
+	CorpusMix::Identifiers, CorpusMix::Operators, CorpusMix::Comments, CorpusMix::Numeric, CorpusMix::NonAscii,
+};
+
+static
+String corpus_mix_name(CorpusMix mix){
+	switch(mix){
+		case CorpusMix::Identifiers: return "identifiers";
+		case CorpusMix::Operators:   return "operators";
+		case CorpusMix::Comments:    return "comments";
+		case CorpusMix::Numeric:     return "numeric";
+		case CorpusMix::NonAscii:    return "non-ASCII";
+	}
+	return "";
+}
+
+// No generated line is longer than this
+constexpr isize max_corpus_line = 512;
+
+struct CorpusWriter {
+	Slice<byte> buf;
+	isize       len;
+	u64         state;
+
+	u64 next(){
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		return state >> 33;
+	}
+
+	isize below(isize n){
+		return isize(next() % u64(n));
+	}
+
+	void put(String s){
+		mem_copy_no_overlap(buf.data() + len, s.data(), s.len());
+		len += s.len();
+	}
+
+	void put(byte c){
+		buf[len] = c;
+		len += 1;
+	}
+
+	template<isize N>
+	void put_any(String const (&choices)[N]){
+		put(choices[below(N)]);
+	}
+
+	void put_identifier(isize min_len, isize max_len){
+		constexpr char const* head = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+		constexpr char const* tail = "abcdefghijklmnopqrstuvwxyz_0123456789";
+		isize n = min_len + below(max_len - min_len + 1);
+		put(byte(head[below(53)]));
+		for(isize i = 1; i < n; i += 1){
+			put(byte(tail[below(37)]));
+		}
+	}
+
+	void put_digits(u64 value, u64 base){
+		byte digits[64];
+		isize n = 0;
+		do {
+			digits[n++] = byte("0123456789abcdef"[value % base]);
+			value /= base;
+		} while(value > 0);
+		while(n > 0){ put(digits[--n]); }
+	}
+};
+
+static
+void put_identifier_line(CorpusWriter* w){
+	String const keywords[] = {"let ", "const ", "return ", "if ", "", "", ""};
+	String const separators[] = {" = ", ", ", ".", " + ", "(", ") "};
+
+	w->put('\t');
+	w->put_any(keywords);
+	isize count = 3 + w->below(6);
+	for(isize i = 0; i < count; i += 1){
+		if(i > 0){ w->put_any(separators); }
+		w->put_identifier(2, 24);
+	}
+	w->put(";\n");
+}
+
+static
+void put_operator_line(CorpusWriter* w){
+	String const operators[] = {
+		"(", ")", "[", "]", "{", "}", "+", "-", "*", "/", "%", "&", "|", "~", ">>", "<<",
+		"&&", "||", "!", ">", "<", ">=", "<=", "==", "!=", "=", "->", ".", "^", ":", ";", ",",
+		"+=", "-=", "*=", "/=", "%=", "&=", "|=",
+	};
+
+	w->put('\t');
+	isize count = 8 + w->below(16);
+	for(isize i = 0; i < count; i += 1){
+		w->put_any(operators);
+		// An operand or a space after every operator so neighbours never
+		// merge into a longer punctuator or a comment
+		if(w->below(2)){ w->put_identifier(1, 2); }
+		else { w->put(' '); }
+	}
+	w->put('\n');
+}
+
+static
+void put_comment_line(CorpusWriter* w){
+	String const words[] = {"the ", "value ", "is ", "kept ", "until ", "next ", "pass ", "TODO: ", "fix ", "this ", "when ", "buffer ", "grows, "};
+
+	if(w->below(4) == 0){
+		put_identifier_line(w);
+		return;
+	}
+	w->put(w->below(2) ? "// " : "\t// ");
+	isize count = 4 + w->below(12);
+	for(isize i = 0; i < count; i += 1){
+		w->put_any(words);
+	}
+	w->put('\n');
+}
+
+static
+void put_numeric_line(CorpusWriter* w){
+	w->put("\tlet ");
+	w->put_identifier(2, 8);
+	w->put(" = [");
+
+	isize count = 4 + w->below(8);
+	for(isize i = 0; i < count; i += 1){
+		if(i > 0){ w->put(", "); }
+		u64 value = w->next() >> w->below(28);
+		switch(w->below(6)){
+			case 0: w->put("0x"); w->put_digits(value, 16); break;
+			case 1: w->put("0b"); w->put_digits(value & 0xffff, 2); break;
+			case 2: w->put("0o"); w->put_digits(value, 8); break;
+			case 3: {
+				w->put_digits(value % 1000, 10);
+				w->put('.');
+				w->put_digits(w->next() % 1000'000, 10);
+			} break;
+			case 4: {
+				w->put_digits(value % 10, 10);
+				w->put('.');
+				w->put_digits(w->next() % 100'000'000, 10);
+				w->put(w->below(2) ? "e-" : "e");
+				w->put_digits(w->below(300), 10);
+			} break;
+			default: w->put_digits(value, 10); break;
+		}
+	}
+	w->put("];\n");
+}
+
+static
+void put_non_ascii_line(CorpusWriter* w){
+	String const names[] = {"café", "naïve", "größe", "日本語", "変数", "λx", "Ωmega", "ñandú", "ключ", "δέλτα", "counter", "value"};
+	String const texts[] = {"\"héllo wörld\"", "\"日本語のテキスト\"", "\"emoji 😀 🚀\"", "\"Привет, мир\"", "\"plain text\""};
+
+	switch(w->below(4)){
+		case 0: {
+			w->put("// Ünïcödé comment, 注释 ");
+			w->put_any(names);
+			w->put('\n');
+		} break;
+		case 1: {
+			w->put("\tlet ");
+			w->put_any(names);
+			w->put(" = ");
+			w->put_any(texts);
+			w->put(";\n");
+		} break;
+		default: {
+			w->put('\t');
+			isize count = 3 + w->below(5);
+			for(isize i = 0; i < count; i += 1){
+				if(i > 0){ w->put(w->below(2) ? " + " : ", "); }
+				w->put_any(names);
+				if(w->below(2)){ w->put_identifier(1, 4); }
+			}
+			w->put(";\n");
+		} break;
+	}
+}
+
+// Exactly `buf.len()` bytes of whole lines in the given mix, padded with line
+// feeds
+static
+String make_synthetic_corpus(Slice<byte> buf, CorpusMix mix, u64 seed){
+	CorpusWriter w;
+	w.buf   = buf;
+	w.len   = 0;
+	w.state = seed ^ (u64(mix) * 0x9e37'79b9'7f4a'7c15);
+
+	while(w.len + max_corpus_line <= buf.len()){
+		switch(mix){
+			case CorpusMix::Identifiers: put_identifier_line(&w); break;
+			case CorpusMix::Operators:   put_operator_line(&w);   break;
+			case CorpusMix::Comments:    put_comment_line(&w);    break;
+			case CorpusMix::Numeric:     put_numeric_line(&w);    break;
+			case CorpusMix::NonAscii:    put_non_ascii_line(&w);  break;
+		}
+	}
+	mem_set(buf.data() + w.len, '\n', buf.len() - w.len);
+
+	return String::from_bytes(buf);
+}
+
+// Time stamp counter ticks, close to core cycles when the clock is not
+// scaled. Zero on targets without one.
+static inline
+u64 cycles_now(){
+	#if defined(__x86_64__) || defined(_M_X64)
+	return __rdtsc();
+	#else
+	return 0;
+	#endif
+}
+
+int main(int argc, char** argv){
+	constexpr isize corpus_size = 16 * 1024 * 1024;
+	constexpr isize iterations = 5;
+
+	// Usage: bench_lexer [--seed N] [--max-size MB] [file]
+	// A file given on the command line is benchmarked instead of the
+	// generated corpus. Synthetic corpora are generated from the seed at
+	// every size from 1 MB up to the maximum.
+	char const* path = nullptr;
+	u64 seed = 0x5eed;
+	isize max_synthetic_size = 64 * 1024 * 1024;
+	for(int i = 1; i < argc; i += 1){
+		String arg = argv[i];
+		if(arg == String("--seed") && i + 1 < argc){
+			seed = strtoull(argv[++i], nullptr, 0);
+		}
+		else if(arg == String("--max-size") && i + 1 < argc){
+			max_synthetic_size = isize(strtoull(argv[++i], nullptr, 0)) * 1024 * 1024;
+		}
+		else {
+			path = argv[i];
+		}
+	}
+
+	String source;
+	MappedFile file;
+	Arena file_arena; /* Only backs files that could not be mapped */
+	defer(if(file_arena.data != nullptr){ heap_allocator()->drop(Slice((byte*)file_arena.data, file_arena.capacity)); });
+	defer(file.close());
+
+	if(path != nullptr){
+		constexpr isize fallback_size = 512 * 1024 * 1024;
+		file_arena = Arena::create(heap_allocator()->make<byte>(fallback_size));
+
+		f64 begin = time_now();
+		auto res = MappedFile::open(path, &file_arena);
+		ensure(res.ok(), "Failed to open source file");
+		file = res.unwrap();
+		printf("Loaded %s (%s) in %.3fs\n", path, file.mapped ? "mmap" : "read", time_now() - begin);
+		source = file.as_string();
+	}
+	else {
+		source = make_corpus(heap_allocator(), corpus_size);
+	}
+
+	f64 best = 1e30;
+	isize token_count = 0;
+
+	for(isize it = 0; it < iterations; it += 1){
+		auto lex = Lexer::create(source);
+		token_count = 0;
+
+		f64 begin = time_now();
+		for(;;){
+			auto res = lex.next();
+			ensure(res.ok(), "Lexer error");
+			auto token = res.unwrap();
+			token_count += 1;
+			if(token.type == TokenType::EndOfFile){ break; }
+		}
+		best = min(best, time_now() - begin);
+	}
+
+	#ifdef KIELO_DISABLE_ASCII_FAST_PATH
+	char const* decode_mode = "utf8_decode only";
+	#else
+	char const* decode_mode = "ASCII fast path";
+	#endif
+
+	#ifdef KIELO_DISABLE_SIMD
+	char const* scan_mode = "scalar scan";
+	#else
+	char const* scan_mode = "SIMD scan";
+	#endif
+
+	#ifdef KIELO_LEXER_DFA
+	char const* backend = "DFA";
+	#else
+	char const* backend = "switch";
+	#endif
+
+	printf("Lexer (%s, %s, %s): %.2f MB in %.3fs, %lld tokens | %.1f MB/s | %.2f Mtokens/s\n",
+		backend, decode_mode, scan_mode,
+		f64(source.len()) / (1024.0 * 1024.0),
+		best,
+		(long long)token_count,
+		(f64(source.len()) / (1024.0 * 1024.0)) / best,
+		(f64(token_count) / 1e6) / best);
+
+	/* UTF-8 validation */ {
+		String snippet = "let név = \"日本語のテキスト\"; // Ünïcödé comment 😀\n";
+		isize count = corpus_size / snippet.len();
+		auto text = heap_allocator()->make<byte>(count * snippet.len());
+		ensure(text.len() > 0, "Failed to allocate corpus");
+		defer(heap_allocator()->drop(text));
+		for(isize i = 0; i < count; i += 1){
+			mem_copy_no_overlap(text.data() + i * snippet.len(), snippet.data(), snippet.len());
+		}
+
+		f64 best_ascii = 1e30, best_mixed = 1e30;
+		for(isize it = 0; it < iterations; it += 1){
+			f64 begin = time_now();
+			ensure(utf8_valid_prefix(source.raw_bytes()) == source.len(), "Source is not valid UTF-8");
+			best_ascii = min(best_ascii, time_now() - begin);
+
+			begin = time_now();
+			ensure(utf8_valid_prefix(text) == text.len(), "Corpus is not valid UTF-8");
+			best_mixed = min(best_mixed, time_now() - begin);
+		}
+
+		#if !defined(CORE_DISABLE_SIMD) && (defined(__AVX2__) || defined(__SSSE3__))
+		char const* validate_mode = "lookup tables";
+		#else
+		char const* validate_mode = "scalar";
+		#endif
+
+		printf("UTF-8 validation (%s): source %.1f MB/s | non-ASCII corpus %.1f MB/s\n",
+			validate_mode,
+			(f64(source.len()) / (1024.0 * 1024.0)) / best_ascii,
+			(f64(text.len()) / (1024.0 * 1024.0)) / best_mixed);
+
+		// Bulk codepoint operations on the same non-ASCII corpus
+		isize runes = utf8_codepoint_count(text);
+		auto decoded = heap_allocator()->make<rune>(runes);
+		ensure(decoded.len() == runes, "Failed to allocate decode buffer");
+		defer(heap_allocator()->drop(decoded));
+
+		f64 best_count = 1e30, best_offset = 1e30, best_decode = 1e30;
+		for(isize it = 0; it < iterations; it += 1){
+			f64 begin = time_now();
+			ensure(utf8_codepoint_count(text) == runes, "Codepoint count changed");
+			best_count = min(best_count, time_now() - begin);
+
+			begin = time_now();
+			ensure(utf8_codepoint_offset(text, runes - 1) < text.len(), "Last codepoint not found");
+			best_offset = min(best_offset, time_now() - begin);
+
+			begin = time_now();
+			ensure(utf8_decode_all(text, decoded) == runes, "Decoded a different number of runes");
+			best_decode = min(best_decode, time_now() - begin);
+		}
+
+		f64 text_mb = f64(text.len()) / (1024.0 * 1024.0);
+		printf("UTF-8 bulk: count %.1f MB/s | nth offset %.1f MB/s | decode %.1f MB/s\n",
+			text_mb / best_count,
+			text_mb / best_offset,
+			text_mb / best_decode);
+	}
+
+	/* Line and column positions */ {
+		String snippet = "let név = \"日本語\"; // Ünïcödé comment 😀\nfn f() {}\r\n\t// x\n";
+		isize count = (1024 * 1024) / snippet.len();
+		auto text = heap_allocator()->make<byte>(count * snippet.len());
+		ensure(text.len() > 0, "Failed to allocate corpus");
+		defer(heap_allocator()->drop(text));
+		for(isize i = 0; i < count; i += 1){
+			mem_copy_no_overlap(text.data() + i * snippet.len(), snippet.data(), snippet.len());
+		}
+
+		isize arena_size = source.len() * 4 + 4096;
+		auto arena = Arena::create(heap_allocator()->make<byte>(arena_size));
+		defer(heap_allocator()->drop(Slice((byte*)arena.data, arena.capacity)));
+
+		// A line comment starts at its slashes, not one byte later because
+		// the line feed ending it is consumed with it
+		{
+			String small = "x // c\ny";
+			auto lines = LineIndex::create(&arena, small);
+			auto lex = Lexer::create(small);
+			lex.next().unwrap();
+			lex.next().unwrap();
+			auto comment = lex.next().unwrap();
+			Position p = lines.position(comment);
+			ensure(comment.type == TokenType::LineComment && p.line == 1 && p.column == 3, "Line comment position is off");
+		}
+
+		check_positions(&arena, source);
+		check_positions(&arena, String::from_bytes(text));
+		printf("Token positions: ok\n");
+	}
+
+	/* Stream lexer */ {
+		isize arena_size = source.len() * 8 + 4096;
+		auto arena = Arena::create(heap_allocator()->make<byte>(arena_size));
+		defer(heap_allocator()->drop(Slice((byte*)arena.data, arena.capacity)));
+
+		constexpr TriviaMode modes[] = {TriviaMode::Tokens, TriviaMode::Skip};
+		constexpr isize window_sizes[] = {16, 64};
+
+		// Trivia longer than the window, and a token that is not trivia
+		// longer than the window
+		{
+			byte buf[128];
+			mem_set(buf, ' ', 100);
+			mem_copy_no_overlap(buf + 100, "abc", 3);
+			for(TriviaMode trivia : modes){
+				check_stream_lexer(&arena, String::from_bytes(Slice(buf, 103)), trivia, 16);
+			}
+
+			String comment = "// Ünïcödé comment much longer than the window 😀😀😀 注释\nx // 😀😀😀😀😀😀\n";
+			for(TriviaMode trivia : modes){
+				check_stream_lexer(&arena, comment, trivia, 16);
+			}
+
+			String long_name = "  identifier_longer_than_the_window = 1;";
+			auto input = ByteBufferStream::from(long_name.raw_bytes());
+			auto lex = StreamLexer::create(&input, Slice(buf, 16));
+			ensure(lex.next().unwrap().type == TokenType::Whitespace, "Expected leading whitespace");
+			auto res = lex.next();
+			ensure(!res.ok() && res.unwrap_error().type == ErrorType::Lexer_TokenTooLong && res.unwrap_error().offset == 2, "Expected Lexer_TokenTooLong at the identifier");
+		}
+
+		// Every alignment of the snippet against the window, so each UTF-8
+		// sequence and the string literal straddle a refill at some point
+		{
+			String snippet = "let név = \"日本語\"; // Ünïcödé 😀\nfn f() {}\n";
+			byte buf[128];
+			for(isize pad = 0; pad < 16; pad += 1){
+				mem_set(buf, ' ', pad);
+				mem_copy_no_overlap(buf + pad, snippet.data(), snippet.len());
+				for(TriviaMode trivia : modes){
+					check_stream_lexer(&arena, String::from_bytes(Slice(buf, pad + snippet.len())), trivia, 16);
+				}
+			}
+		}
+
+		auto integers = make_integer_corpus(heap_allocator(), 20'000);
+		defer(heap_allocator()->drop(integers.raw_bytes()));
+		auto reals = make_real_corpus(heap_allocator(), 20'000);
+		defer(heap_allocator()->drop(reals.raw_bytes()));
+		auto strings = make_string_corpus(heap_allocator(), 5'000);
+		defer(heap_allocator()->drop(strings.raw_bytes()));
+
+		String corpora[] = {source, integers, reals, strings};
+		for(String corpus : corpora){
+			for(TriviaMode trivia : modes){
+				for(isize window_size : window_sizes){
+					check_stream_lexer(&arena, corpus, trivia, window_size);
+				}
+			}
+		}
+		printf("Stream lexer: ok\n");
+	}
+
+	/* Identifier interning */ {
+		constexpr isize interner_size = 64 * 1024 * 1024;
+		auto arena = Arena::create(heap_allocator()->make<byte>(interner_size));
+		defer(heap_allocator()->drop(Slice((byte*)arena.data, arena.capacity)));
+
+		auto interner = Interner::create(&arena);
+		auto lex = Lexer::create(source);
+		lex.interner = &interner;
+		lex.trivia = TriviaMode::Skip;
+		isize identifiers = 0;
+
+		f64 begin = time_now();
+		for(;;){
+			auto res = lex.next();
+			ensure(res.ok(), "Lexer error");
+			auto token = res.unwrap();
+			if(token.type == TokenType::EndOfFile){ break; }
+			identifiers += token.type == TokenType::Identifier;
+		}
+		f64 elapsed = time_now() - begin;
+
+		printf("Interned lexing: %lld identifiers, %lld symbols in %.3fs | %.1f MB/s\n",
+			(long long)identifiers,
+			(long long)interner.count,
+			elapsed,
+			(f64(source.len()) / (1024.0 * 1024.0)) / elapsed);
+	}
+
+	/* Structure-of-arrays token stream */ {
+		isize arena_size = source.len() * 8 + 4096;
+		auto arena = Arena::create(heap_allocator()->make<byte>(arena_size));
+		defer(heap_allocator()->drop(Slice((byte*)arena.data, arena.capacity)));
+
+		f64 begin = time_now();
+		auto stream = tokenize_all(&arena, source).unwrap();
+		f64 elapsed = time_now() - begin;
+
+		printf("tokenize_all: %lld tokens in %.3fs | %.2f MB of token arrays (%.2f MB arena)\n",
+			(long long)stream.count,
+			elapsed,
+			f64(stream.count * (sizeof(u8) + sizeof(u32))) / (1024.0 * 1024.0),
+			f64(arena.offset) / (1024.0 * 1024.0));
+
+		begin = time_now();
+		auto parallel = tokenize_all_parallel(&arena, source).unwrap();
+		elapsed = time_now() - begin;
+
+		ensure(same_stream(parallel, stream), "Parallel tokenizer produced a different stream");
+		printf("tokenize_all_parallel: %lld tokens in %.3fs on %lld threads\n",
+			(long long)parallel.count,
+			elapsed,
+			(long long)hardware_thread_count());
+
+		arena.free_all();
+
+		begin = time_now();
+		auto significant = tokenize_all(&arena, source, TriviaMode::Skip).unwrap();
+		elapsed = time_now() - begin;
+
+		printf("tokenize_all (skip trivia): %lld tokens in %.3fs\n",
+			(long long)significant.count,
+			elapsed);
+
+		// Stitching is checked on several chunks even where the timed run
+		// above got a single thread
+		{
+			auto region = ArenaRegion::create(&arena);
+			auto stitched = tokenize_all_parallel(&arena, source, 4, TriviaMode::Skip).unwrap();
+			ensure(same_stream(stitched, significant), "Parallel tokenizer produced a different stream without trivia");
+			region.release();
+		}
+
+		// Single space insertions spread over the source, each relexed into
+		// the stream the ones before left. The first edit moves the source
+		// into the stream's arena.
+		constexpr isize edit_count = 100;
+		isize relexed = 0;
+		f64 first_edit = 0, total = 0;
+		for(isize e = 0; e < edit_count; e += 1){
+			TextEdit edit;
+			edit.offset   = (source.len() / edit_count) * e + 7;
+			edit.removed  = 0;
+			edit.inserted = String(" ").raw_bytes();
+
+			begin = time_now();
+			auto res = relex(&significant, edit);
+			f64 elapsed = time_now() - begin;
+			if(e == 0){ first_edit = elapsed; }
+			else { total += elapsed; }
+
+			ensure(res.ok(), "Lexer error");
+			auto change = res.unwrap();
+			relexed += change.new_end - change.first;
+		}
+
+		printf("relex (skip trivia): first edit %.1f us, then %lld edits, %.1f us and %.1f tokens per edit\n",
+			first_edit * 1e6,
+			(long long)(edit_count - 1),
+			(total / (edit_count - 1)) * 1e6,
+			f64(relexed) / edit_count);
+
+		// Some more spaces typed and deleted again, against lexing the edited
+		// source from scratch
+		for(isize e = 0; e < 20; e += 1){
+			TextEdit edit;
+			edit.offset   = (significant.text_len / 10) * (e / 2) + 11;
+			edit.removed  = e % 2;
+			edit.inserted = e % 2 == 0 ? String(" ").raw_bytes() : Slice<byte>{};
+			ensure(relex(&significant, edit).ok(), "Lexer error");
+
+			auto region = ArenaRegion::create(&arena);
+			auto fresh = tokenize_all(&arena, significant.text(), TriviaMode::Skip).unwrap();
+			ensure(same_stream(significant, fresh), "Relexed stream differs from lexing the edited source");
+			region.release();
+		}
+	}
+
+	/* Syntax tree */ {
+		auto program = make_program_corpus(heap_allocator(), corpus_size);
+		defer(heap_allocator()->drop(program.raw_bytes()));
+
+		// Token stream, tree, the bigger storage relex and reparse move them
+		// to and a tree parsed from scratch at a time to check it
+		isize arena_size = program.len() * 24 + 4096;
+		auto arena = Arena::create(heap_allocator()->make<byte>(arena_size));
+		defer(heap_allocator()->drop(Slice((byte*)arena.data, arena.capacity)));
+
+		auto stream = tokenize_all(&arena, program, TriviaMode::Skip).unwrap();
+
+		f64 best_parse = 1e30;
+		for(isize it = 0; it < iterations; it += 1){
+			auto region = ArenaRegion::create(&arena);
+			f64 begin = time_now();
+			auto res = parse(&arena, &stream);
+			best_parse = min(best_parse, time_now() - begin);
+			ensure(res.ok(), "Parse error in program corpus");
+			region.release();
+		}
+		Ast ast = parse(&arena, &stream).unwrap();
+
+		f64 best_parallel = 1e30;
+		for(isize it = 0; it < iterations; it += 1){
+			auto region = ArenaRegion::create(&arena);
+			f64 begin = time_now();
+			auto res = parse_parallel(&arena, &stream);
+			best_parallel = min(best_parallel, time_now() - begin);
+			ensure(res.ok(), "Parse error in program corpus");
+			ensure(same_ast(res.unwrap(), ast), "Parallel parser produced a different tree");
+			region.release();
+		}
+
+		// Merging is checked on several chunks even where the timed runs got
+		// a single thread
+		{
+			auto region = ArenaRegion::create(&arena);
+			auto merged = parse_parallel(&arena, &stream, 4).unwrap();
+			ensure(same_ast(merged, ast), "Parallel parser produced a different tree");
+			region.release();
+		}
+
+		isize flat_bytes = ast.count * isize(sizeof(NodeKind) + sizeof(u32) + sizeof(NodeData)) + ast.extra_count * isize(sizeof(u32)) + ast.root_count * isize(sizeof(Declaration));
+		printf("parse: %.2f MB, %lld nodes in %.3fs | %.1f MB/s | %.2f Mnodes/s\n",
+			f64(program.len()) / (1024.0 * 1024.0),
+			(long long)ast.count,
+			best_parse,
+			(f64(program.len()) / (1024.0 * 1024.0)) / best_parse,
+			(f64(ast.count) / 1e6) / best_parse);
+		printf("parse_parallel: %lld nodes in %.3fs on %lld threads | %.1f MB/s\n",
+			(long long)ast.count,
+			best_parallel,
+			(long long)hardware_thread_count(),
+			(f64(program.len()) / (1024.0 * 1024.0)) / best_parallel);
+
+		PointerTree tree = {};
+		f64 begin = time_now();
+		tree.root = to_pointer_tree(&tree, ast, Declaration{}, 0);
+		f64 build_time = time_now() - begin;
+		defer(free_pointer_tree(tree.root));
+		ensure(tree.nodes == ast.count, "Pointer tree has a different number of nodes");
+
+		f64 best_flat = 1e30, best_pointer = 1e30, best_scan = 1e30;
+		u64 flat_sum = 0, pointer_sum = 0;
+		for(isize it = 0; it < iterations; it += 1){
+			begin = time_now();
+			flat_sum = walk_ast(ast, Declaration{}, 0);
+			best_flat = min(best_flat, time_now() - begin);
+
+			// Queries over one column don't need a walk at all
+			begin = time_now();
+			isize calls = 0;
+			for(NodeKind kind : ast.kinds[{0, ast.count}]){
+				calls += kind == NodeKind::Call;
+			}
+			best_scan = min(best_scan, time_now() - begin);
+			ensure(calls > 0, "No calls in program corpus");
+
+			begin = time_now();
+			pointer_sum = walk_pointer_tree(tree.root);
+			best_pointer = min(best_pointer, time_now() - begin);
+		}
+		ensure(flat_sum == pointer_sum, "Trees differ");
+
+		printf("AST memory: flat %.2f MB (%.1f bytes/node) | pointer %.2f MB (%.1f bytes/node + allocator overhead) built in %.3fs\n",
+			f64(flat_bytes) / (1024.0 * 1024.0),
+			f64(flat_bytes) / f64(ast.count),
+			f64(tree.bytes) / (1024.0 * 1024.0),
+			f64(tree.bytes) / f64(tree.nodes),
+			build_time);
+		printf("AST walk: flat %.1f Mnodes/s | pointer %.1f Mnodes/s | flat kind scan %.1f Mnodes/s\n",
+			(f64(ast.count) / 1e6) / best_flat,
+			(f64(tree.nodes) / 1e6) / best_pointer,
+			(f64(ast.count) / 1e6) / best_scan);
+
+		// Single spaces inserted before tokens spread over the program, each
+		// relexed into the stream and then reparsed into the tree left by the
+		// edits before. The first edit moves the source and the tree to
+		// storage with room to grow, it is timed on its own.
+		constexpr isize edit_count = 20;
+		isize reparsed = 0;
+		f64 first_relex = 0, first_reparse = 0;
+		f64 relex_total = 0, reparse_total = 0;
+		for(isize e = 0; e <= edit_count; e += 1){
+			TokenStream* tokens = ast.tokens;
+			TextEdit edit;
+			edit.offset   = tokens->offset((tokens->count / edit_count) * (e % edit_count) + 7);
+			edit.removed  = 0;
+			edit.inserted = String(" ").raw_bytes();
+
+			f64 begin = time_now();
+			auto change = relex(tokens, edit).unwrap();
+			f64 middle = time_now();
+			auto res = reparse(&arena, &ast, &change);
+			f64 end = time_now();
+
+			ensure(res.ok(), "Parse error in edited program");
+			auto update = res.unwrap();
+			if(e == 0){
+				first_relex = middle - begin;
+				first_reparse = end - middle;
+			}
+			else {
+				relex_total += middle - begin;
+				reparse_total += end - middle;
+				reparsed += update.new_end - update.first;
+			}
+
+			// Some of the edits against parsing the edited stream from scratch
+			if(e % 5 == 0){
+				auto region = ArenaRegion::create(&arena);
+				auto fresh = parse(&arena, ast.tokens).unwrap();
+				ensure(same_tree(ast, fresh), "Reparsed tree differs from parsing the edited program");
+				region.release();
+			}
+		}
+
+		printf("reparse: first edit %.1f us relex + %.1f us reparse, then %lld edits, %.1f us relex + %.1f us reparse and %.1f declarations per edit\n",
+			first_relex * 1e6,
+			first_reparse * 1e6,
+			(long long)edit_count,
+			(relex_total / edit_count) * 1e6,
+			(reparse_total / edit_count) * 1e6,
+			f64(reparsed) / edit_count);
+	}
+
+	/* Error recovery */ {
+		using K = NodeKind;
+		auto arena = Arena::create(heap_allocator()->make<byte>(1024 * 1024));
+		defer(heap_allocator()->drop(Slice((byte*)arena.data, arena.capacity)));
+
+		// Synchronising stops after the brace that closes the broken
+		// declaration, not at the next `;`
+		K broken_struct[] = { K::Error, K::ConstDecl, K::FnDecl };
+		check_recovery(&arena, "struct S { a: , b: i32 }\nconst k = 1;\nfn f() {}\n", Slice(broken_struct, 3));
+		K broken_fn[] = { K::Error, K::ConstDecl };
+		check_recovery(&arena, "fn g(a: ) { return a; }\nconst k = 1;\n", Slice(broken_fn, 2));
+		K broken_const[] = { K::Error, K::LetDecl, K::FnDecl };
+		check_recovery(&arena, "const k = ;\nlet v = 2;\nfn f() {}\n", Slice(broken_const, 3));
+		K broken_let[] = { K::Error, K::ConstDecl };
+		check_recovery(&arena, "let v = 1 +\nconst k = 1;\n", Slice(broken_let, 2));
+
+		using E = ErrorType;
+		BadToken bad[] = {
+			{ "@",                       E::Lexer_BadCodepoint,     1 },
+			{ "\xff",                    E::Lexer_BadCodepoint,     1 },
+			{ "€",                       E::Lexer_BadCodepoint,     3 },
+			{ "\"bad \\q escape\"",      E::Lexer_BadEscape,        5 },
+			{ "0x",                      E::Lexer_MissingDigits,    2 },
+			{ "0b102",                   E::Lexer_InvalidDigit,     4 },
+			{ "0q7",                     E::Lexer_InvalidBase,      0 },
+			{ "99999999999999999999999", E::Lexer_IntegerOverflow, 23 },
+			{ "1e999",                   E::Lexer_RealOverflow,     5 },
+			{ "12abc",                   E::Lexer_InvalidDigit,     2 },
+			{ "1.5e+",                   E::Lexer_MissingDigits,    5 },
+		};
+		check_lexer_recovery(&arena, Slice(bad, 11), TriviaMode::Tokens);
+		check_lexer_recovery(&arena, Slice(bad, 11), TriviaMode::Skip);
+
+		printf("Error recovery: ok\n");
+	}
+
+	/* Integer literals */ {
+		constexpr isize literal_count = 4 * 1000 * 1000;
+		auto literals = make_integer_corpus(heap_allocator(), literal_count);
+		defer(heap_allocator()->drop(literals.raw_bytes()));
+
+		f64 best_literals = 1e30;
+		for(isize it = 0; it < iterations; it += 1){
+			auto lex = Lexer::create(literals);
+			isize count = 0;
+
+			f64 begin = time_now();
+			for(;;){
+				auto res = lex.next();
+				ensure(res.ok(), "Lexer error");
+				auto token = res.unwrap();
+				if(token.type == TokenType::EndOfFile){ break; }
+				count += token.type == TokenType::Integer;
+			}
+			best_literals = min(best_literals, time_now() - begin);
+			ensure(count == literal_count, "Wrong number of integer literals");
+		}
+
+		#ifdef KIELO_DISABLE_SWAR
+		char const* digit_mode = "scalar digits";
+		#else
+		char const* digit_mode = "SWAR digits";
+		#endif
+
+		printf("Integer literals (%s): %lld in %.3fs | %.2f Mliterals/s\n",
+			digit_mode,
+			(long long)literal_count,
+			best_literals,
+			(f64(literal_count) / 1e6) / best_literals);
+	}
+
+	/* Real literals */ {
+		constexpr isize literal_count = 4 * 1000 * 1000;
+		auto literals = make_real_corpus(heap_allocator(), literal_count);
+		defer(heap_allocator()->drop(literals.raw_bytes()));
+
+		f64 best_literals = 1e30;
+		for(isize it = 0; it < iterations; it += 1){
+			auto lex = Lexer::create(literals);
+			isize count = 0;
+
+			f64 begin = time_now();
+			for(;;){
+				auto res = lex.next();
+				ensure(res.ok(), "Lexer error");
+				auto token = res.unwrap();
+				if(token.type == TokenType::EndOfFile){ break; }
+				count += token.type == TokenType::Real;
+			}
+			best_literals = min(best_literals, time_now() - begin);
+			ensure(count == literal_count, "Wrong number of real literals");
+		}
+
+		printf("Real literals: %lld in %.3fs | %.2f Mliterals/s | %.1f MB/s\n",
+			(long long)literal_count,
+			best_literals,
+			(f64(literal_count) / 1e6) / best_literals,
+			(f64(literals.len()) / (1024.0 * 1024.0)) / best_literals);
+	}
+
+	/* String literals */ {
+		constexpr isize literal_count = 1000 * 1000;
+		auto literals = make_string_corpus(heap_allocator(), literal_count);
+		defer(heap_allocator()->drop(literals.raw_bytes()));
+
+		constexpr isize scratch_size = 64 * 1024 * 1024;
+		auto scratch = Arena::create(heap_allocator()->make<byte>(scratch_size));
+		defer(heap_allocator()->drop(Slice((byte*)scratch.data, scratch.capacity)));
+
+		f64 best_literals = 1e30;
+		for(isize it = 0; it < iterations; it += 1){
+			auto lex = Lexer::create(literals);
+			lex.scratch = &scratch;
+			isize count = 0;
+
+			f64 begin = time_now();
+			for(;;){
+				auto res = lex.next();
+				ensure(res.ok(), "Lexer error");
+				auto token = res.unwrap();
+				if(token.type == TokenType::EndOfFile){ break; }
+				count += token.type == TokenType::String;
+			}
+			best_literals = min(best_literals, time_now() - begin);
+			ensure(count == literal_count, "Wrong number of string literals");
+			scratch.free_all();
+		}
+
+		printf("String literals (%s): %lld in %.3fs | %.1f MB/s\n",
+			scan_mode,
+			(long long)literal_count,
+			best_literals,
+			(f64(literals.len()) / (1024.0 * 1024.0)) / best_literals);
+	}
+
+	/* Synthetic corpora */ {
+		constexpr isize sizes[] = {1, 16, 256, 1024};
+		auto buf = heap_allocator()->make<byte>(max_synthetic_size);
+		ensure(buf.len() == max_synthetic_size, "Failed to allocate synthetic corpus");
+		defer(heap_allocator()->drop(buf));
+
+		printf("Synthetic corpora (seed %#llx):\n", (unsigned long long)seed);
+		for(CorpusMix mix : corpus_mixes){
+			for(isize mb : sizes){
+				isize size = mb * 1024 * 1024;
+				if(size > max_synthetic_size){ break; }
+				auto corpus = make_synthetic_corpus(buf[{0, size}], mix, seed);
+
+				// Positions and the stream lexer are checked on the smallest
+				// size of every mix
+				if(mb == sizes[0]){
+					auto arena = Arena::create(heap_allocator()->make<byte>(size * 8 + 4096));
+					defer(heap_allocator()->drop(Slice((byte*)arena.data, arena.capacity)));
+					check_positions(&arena, corpus);
+					check_stream_lexer(&arena, corpus, TriviaMode::Tokens, 16);
+					check_stream_lexer(&arena, corpus, TriviaMode::Skip, 64);
+				}
+
+				// Small corpora are lexed more times to get a stable best time
+				isize runs = clamp(isize(1), (256 * 1024 * 1024) / size, isize(50));
+				f64 best_time = 1e30;
+				u64 best_cycles = 0;
+				isize tokens = 0;
+
+				for(isize it = 0; it < runs; it += 1){
+					auto lex = Lexer::create(corpus);
+					tokens = 0;
+
+					f64 begin = time_now();
+					u64 cycles_begin = cycles_now();
+					for(;;){
+						auto res = lex.next();
+						ensure(res.ok(), "Lexer error in synthetic corpus");
+						tokens += 1;
+						if(res.unwrap().type == TokenType::EndOfFile){ break; }
+					}
+					u64 cycles = cycles_now() - cycles_begin;
+					f64 elapsed = time_now() - begin;
+
+					if(elapsed < best_time){
+						best_time = elapsed;
+						best_cycles = cycles;
+					}
+				}
+
+				String name = corpus_mix_name(mix);
+				printf("  %-12.*s %5lld MB: %8.1f MB/s | %7.2f Mtokens/s | %6.1f cycles/token\n",
+					int(name.len()), name.data(),
+					(long long)mb,
+					f64(mb) / best_time,
+					(f64(tokens) / 1e6) / best_time,
+					f64(best_cycles) / f64(tokens));
+			}
+		}
+	}
+
+	return 0;
+}
@@ -8,6 +8,7 @@ clang++ -Os -std=c++20 -o main.exe \
 	-fno-strict-aliasing \
 	-fsanitize=address \
 	-Wall -Wextra \
+	-pthread \
 	-static-libgcc \
 	main.cpp kielo.cpp core/core.cpp
 
@@ -103,4 +103,11 @@ void ArenaRegion::release(){
 	a->region_count -= 1;
 }
 
+Arena* thread_arena(){
+	constexpr isize thread_arena_size = 1 * 1024 * 1024;
+	thread_local byte thread_arena_memory[thread_arena_size];
+	thread_local Arena arena = Arena::create(Slice(&thread_arena_memory[0], thread_arena_size));
+	return &arena;
+}
+
 } /* Universal namespace */
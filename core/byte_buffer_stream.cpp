@@ -14,7 +14,10 @@ Result<i64, StreamError> ByteBufferStream::read(Slice<byte> buf, i64 offset, See
 	}
 
 	pos += offset;
-	if(pos < start || pos >= end){
+	if(pos == end){
+		return StreamError::EndOfStream;
+	}
+	if(pos < start || pos > end){
 		return StreamError::InvalidOffset;
 	}
 
@@ -4,6 +4,7 @@
 #include "arena.cpp"
 #include "heap_allocator.cpp"
 #include "utf8.cpp"
+#include "utf8_simd.cpp"
 #include "byte_buffer_stream.cpp"
 #include "print.cpp"
-
+#include "file.cpp"
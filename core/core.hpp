@@ -503,6 +503,40 @@ UTF8Encode utf8_encode(rune c);
 
 UTF8Decode utf8_decode(Slice<byte> buf);
 
+// Length of the longest prefix of `buf` that is valid UTF-8, equal to
+// `buf.len()` when all of it is. Overlong forms, surrogates and codepoints
+// past U+10FFFF are rejected.
+isize utf8_valid_prefix(Slice<byte> buf);
+
+// Number of codepoints in `buf`, which is the number of bytes that are not
+// continuation bytes
+isize utf8_codepoint_count(Slice<byte> buf);
+
+// Byte offset of the codepoint with index `n`, `buf.len()` if there are not
+// that many
+isize utf8_codepoint_offset(Slice<byte> buf, isize n);
+
+// Decode valid UTF-8 from `buf` into `out` until either runs out, returns the
+// number of runes written. utf8_codepoint_count(buf) runes always fit.
+isize utf8_decode_all(Slice<byte> buf, Slice<rune> out);
+
+// Decode the rune at `p` without any checks, only for input that already
+// passed utf8_valid_prefix
+static forceinline
+UTF8Decode utf8_decode_unchecked(byte const* p){
+	byte first = p[0];
+	if(first < 0x80){
+		return { .codepoint = rune(first), .len = 1 };
+	}
+	if(first < 0xe0){
+		return { .codepoint = rune(((first & 0x1f) << 6) | (p[1] & 0x3f)), .len = 2 };
+	}
+	if(first < 0xf0){
+		return { .codepoint = rune(((first & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f)), .len = 3 };
+	}
+	return { .codepoint = rune(((first & 0x07) << 18) | ((p[1] & 0x3f) << 12) | ((p[2] & 0x3f) << 6) | (p[3] & 0x3f)), .len = 4 };
+}
+
 static inline
 bool utf8_is_continuation_byte(rune c){
 	constexpr rune CONTINUATION1 = 0x80;
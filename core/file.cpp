@@ -0,0 +1,146 @@
+#include "file.hpp"
+
+#include <stdio.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace core {
+
+constexpr isize file_path_max = 4096;
+constexpr isize file_read_block = 64 * 1024;
+
+#if defined(_WIN32)
+Result<MappedFile, FileError> MappedFile::open(String path, Arena* fallback){
+	char cpath[file_path_max];
+	if(path.len() >= file_path_max){ return FileError::PathTooLong; }
+	mem_copy_no_overlap(cpath, path.data(), path.len());
+	cpath[path.len()] = 0;
+
+	FILE* f = fopen(cpath, "rb");
+	if(f == nullptr){ return FileError::NotFound; }
+	defer(fclose(f));
+
+	MappedFile file;
+	byte* buf = nullptr;
+	isize len = 0;
+	isize cap = 0;
+
+	for(;;){
+		if(len == cap){
+			isize new_cap = cap + max(file_read_block, cap);
+			buf = (byte*)fallback->realloc(buf, cap, new_cap, alignof(byte));
+			if(buf == nullptr){ return FileError::OutOfMemory; }
+			cap = new_cap;
+		}
+		isize n = isize(fread(buf + len, 1, usize(cap - len), f));
+		if(n == 0){
+			if(ferror(f)){ return FileError::ReadFailed; }
+			break;
+		}
+		len += n;
+	}
+
+	file.data = Slice<byte>(buf, len);
+	return file;
+}
+
+void MappedFile::close(){
+	data = {};
+	mapped = false;
+}
+
+#else
+Result<MappedFile, FileError> MappedFile::open(String path, Arena* fallback){
+	char cpath[file_path_max];
+	if(path.len() >= file_path_max){ return FileError::PathTooLong; }
+	mem_copy_no_overlap(cpath, path.data(), path.len());
+	cpath[path.len()] = 0;
+
+	int fd = ::open(cpath, O_RDONLY);
+	if(fd < 0){ return FileError::NotFound; }
+	defer(::close(fd));
+
+	MappedFile file;
+
+	struct stat info;
+	if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0){
+		void* p = mmap(nullptr, usize(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if(p != MAP_FAILED){
+			madvise(p, usize(info.st_size), MADV_SEQUENTIAL);
+			file.data = Slice<byte>((byte*)p, isize(info.st_size));
+			file.mapped = true;
+			return file;
+		}
+	}
+
+	// Could not map it, read the whole thing into the arena instead
+	byte* buf = nullptr;
+	isize len = 0;
+	isize cap = 0;
+
+	for(;;){
+		if(len == cap){
+			isize new_cap = cap + max(file_read_block, cap);
+			buf = (byte*)fallback->realloc(buf, cap, new_cap, alignof(byte));
+			if(buf == nullptr){ return FileError::OutOfMemory; }
+			cap = new_cap;
+		}
+		isize n = ::read(fd, buf + len, usize(cap - len));
+		if(n < 0){ return FileError::ReadFailed; }
+		if(n == 0){ break; }
+		len += n;
+	}
+
+	file.data = Slice<byte>(buf, len);
+	return file;
+}
+
+void MappedFile::close(){
+	if(mapped){
+		munmap(data.data(), usize(data.len()));
+	}
+	data = {};
+	mapped = false;
+}
+#endif
+
+Result<i64, StreamError> FileStream::read(Slice<byte> buf, i64 offset, SeekPos whence){
+	if(offset != 0 || whence != SeekPos::Current){
+		return StreamError::Unsupported;
+	}
+	if(handle == nullptr){
+		return StreamError::Closed;
+	}
+
+	auto f = (FILE*)handle;
+	isize n = isize(fread(buf.data(), 1, usize(buf.len()), f));
+	if(n == 0 && buf.len() > 0){
+		return ferror(f) ? StreamError::BrokenChannel : StreamError::EndOfStream;
+	}
+	return n;
+}
+
+Result<i64, StreamError> FileStream::write(Slice<byte>, i64, SeekPos){
+	return StreamError::Unsupported;
+}
+
+Result<i64, StreamError> FileStream::seek(i64, SeekPos){
+	return StreamError::Unsupported;
+}
+
+StreamMode FileStream::capabilities(){
+	return stream_mode_read;
+}
+
+FileStream FileStream::standard_input(){
+	FileStream fs;
+	fs.handle = (void*)stdin;
+	return fs;
+}
+
+}
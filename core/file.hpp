@@ -0,0 +1,54 @@
+#pragma once
+
+#include "core.hpp"
+#include "memory.hpp"
+#include "stream.hpp"
+
+namespace core {
+
+enum class FileError : u32 {
+	None = 0,
+
+	NotFound,
+	PathTooLong,
+	ReadFailed,
+	OutOfMemory,
+};
+
+// Read-only view of a whole file. Where the platform allows it the file is
+// memory mapped and paged in on demand, otherwise (pipes, special files,
+// platforms without mmap) its contents are read into the fallback arena.
+struct MappedFile {
+	Slice<byte> data;
+	bool mapped;
+
+	static Result<MappedFile, FileError> open(String path, Arena* fallback);
+
+	void close();
+
+	String as_string() const {
+		return String::from_bytes(data);
+	}
+
+	MappedFile() : data{}, mapped{false} {}
+};
+
+// Sequential read-only stream over an already open C stdio file, used for
+// input that cannot be mapped such as pipes.
+struct FileStream : Stream {
+	void* handle;
+
+	Result<i64, StreamError> read(Slice<byte> buf, i64 offset = 0, SeekPos whence = SeekPos::Current) override;
+
+	Result<i64, StreamError> write(Slice<byte> buf, i64 offset = 0, SeekPos whence = SeekPos::Current) override;
+
+	Result<i64, StreamError> seek(i64 offset, SeekPos whence) override;
+
+	StreamMode capabilities() override;
+
+	static FileStream standard_input();
+
+	FileStream() : handle{nullptr} {}
+};
+
+}
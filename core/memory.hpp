@@ -137,6 +137,9 @@ struct Arena : Allocator {
 
 };
 
+// Get the calling thread's scratch arena
+Arena* thread_arena();
+
 //// Heap allocator
 void* heap_alloc(isize size, isize align);
 
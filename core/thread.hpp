@@ -0,0 +1,15 @@
+#pragma once
+
+#include "core.hpp"
+
+#include <thread>
+
+namespace core {
+using Thread = std::thread;
+
+// Number of hardware threads available, at least 1
+static inline
+isize hardware_thread_count(){
+	return max(isize(1), isize(std::thread::hardware_concurrency()));
+}
+};
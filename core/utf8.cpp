@@ -41,7 +41,7 @@ u32 utf8_rune_size(rune c){
 UTF8Encode utf8_encode(rune c){
 	UTF8Encode res = {};
 
-	if(utf8_is_continuation_byte(c) ||
+	if((c < 0) ||
 	   (c >= UTF16_SURROGATE1 && c <= UTF16_SURROGATE2) ||
 	   (c > UTF8_RANGE4))
 	{
@@ -0,0 +1,552 @@
+#include "core.hpp"
+
+// Whole buffer UTF-8 routines. Vector kernels are picked at compile time:
+// AVX2, then SSE2, with scalar fallbacks working a word at a time. Validation
+// needs a byte shuffle, so on SSE2 it only vectorizes when SSSE3 is available
+// too. Define CORE_DISABLE_SIMD to force the scalar versions.
+
+#if !defined(CORE_DISABLE_SIMD)
+	#if defined(__AVX2__)
+		#define CORE_UTF8_AVX2 1
+	#elif defined(__SSE2__) || defined(_M_X64)
+		#define CORE_UTF8_SSE2 1
+	#endif
+#endif
+
+#if defined(CORE_UTF8_AVX2) || defined(CORE_UTF8_SSE2)
+	#define CORE_UTF8_VECTOR 1
+	#include <immintrin.h>
+#endif
+
+#if defined(CORE_UTF8_AVX2) || (defined(CORE_UTF8_SSE2) && defined(__SSSE3__))
+	#define CORE_UTF8_LOOKUP 1
+#endif
+
+namespace core {
+
+//// Scalar validation
+static forceinline
+bool utf8_word_is_ascii(byte const* p){
+	u64 w;
+	mem_copy_no_overlap(&w, p, 8);
+	return (w & 0x8080'8080'8080'8080) == 0;
+}
+
+// Length of the valid sequence at the start of `p`, 0 if it is malformed
+static inline
+isize utf8_sequence_length(byte const* p, isize len){
+	byte b0 = p[0];
+	if(b0 < 0x80){ return 1; }
+
+	auto cont = [&](isize i){ return i < len && (p[i] & 0xc0) == 0x80; };
+
+	if(b0 >= 0xc2 && b0 <= 0xdf){
+		return cont(1) ? 2 : 0;
+	}
+	if(b0 >= 0xe0 && b0 <= 0xef){
+		if(!cont(1) || !cont(2)){ return 0; }
+		if(b0 == 0xe0 && p[1] < 0xa0){ return 0; } /* Overlong */
+		if(b0 == 0xed && p[1] > 0x9f){ return 0; } /* Surrogate */
+		return 3;
+	}
+	if(b0 >= 0xf0 && b0 <= 0xf4){
+		if(!cont(1) || !cont(2) || !cont(3)){ return 0; }
+		if(b0 == 0xf0 && p[1] < 0x90){ return 0; } /* Overlong */
+		if(b0 == 0xf4 && p[1] > 0x8f){ return 0; } /* Past U+10FFFF */
+		return 4;
+	}
+	return 0;
+}
+
+static
+isize utf8_valid_prefix_scalar(Slice<byte> buf, isize start){
+	byte const* data = buf.data();
+	isize len = buf.len();
+	isize i = start;
+
+	while(i < len){
+		if(i + 8 <= len && utf8_word_is_ascii(data + i)){
+			i += 8;
+			continue;
+		}
+		isize n = utf8_sequence_length(data + i, len - i);
+		if(n == 0){ return i; }
+		i += n;
+	}
+	return len;
+}
+
+//// Vector primitives
+#if defined(CORE_UTF8_VECTOR)
+namespace utf8_vector {
+#if defined(CORE_UTF8_AVX2)
+using Vec = __m256i;
+constexpr isize vec_width = 32;
+
+static forceinline Vec vec_load(byte const* p){ return _mm256_loadu_si256((Vec const*)p); }
+static forceinline Vec vec_splat(byte b){ return _mm256_set1_epi8(char(b)); }
+static forceinline Vec vec_zero(){ return _mm256_setzero_si256(); }
+static forceinline Vec vec_and(Vec a, Vec b){ return _mm256_and_si256(a, b); }
+static forceinline Vec vec_or(Vec a, Vec b){ return _mm256_or_si256(a, b); }
+static forceinline Vec vec_xor(Vec a, Vec b){ return _mm256_xor_si256(a, b); }
+static forceinline Vec vec_subs(Vec a, Vec b){ return _mm256_subs_epu8(a, b); }
+static forceinline bool vec_any(Vec v){ return !_mm256_testz_si256(v, v); }
+static forceinline bool vec_is_ascii(Vec v){ return _mm256_movemask_epi8(v) == 0; }
+static forceinline Vec vec_high_nibble(Vec v){ return _mm256_and_si256(_mm256_srli_epi16(v, 4), vec_splat(0x0f)); }
+static forceinline Vec vec_low_nibble(Vec v){ return _mm256_and_si256(v, vec_splat(0x0f)); }
+static forceinline u32 vec_mask(Vec v){ return u32(_mm256_movemask_epi8(v)); }
+static forceinline u32 vec_lead_mask(Vec v){ return u32(_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, vec_splat(0xbf)))); }
+
+// Zero extend the 32 ASCII bytes at `p` to runes
+static forceinline
+void vec_widen_store(rune* out, byte const* p){
+	for(isize k = 0; k < 4; k += 1){
+		__m128i eight = _mm_loadl_epi64((__m128i const*)(p + k * 8));
+		_mm256_storeu_si256((Vec*)(out + k * 8), _mm256_cvtepu8_epi32(eight));
+	}
+}
+
+static forceinline
+Vec vec_lookup(Vec index, byte const (&table)[16]){
+	Vec t = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)table));
+	return _mm256_shuffle_epi8(t, index);
+}
+
+// Bytes of `input` shifted later by N, filled from the end of `prev`
+template<int N>
+static forceinline
+Vec vec_prev(Vec input, Vec prev){
+	Vec straddle = _mm256_permute2x128_si256(prev, input, 0x21);
+	return _mm256_alignr_epi8(input, straddle, 16 - N);
+}
+
+#elif defined(CORE_UTF8_SSE2)
+using Vec = __m128i;
+constexpr isize vec_width = 16;
+
+static forceinline Vec vec_load(byte const* p){ return _mm_loadu_si128((Vec const*)p); }
+static forceinline Vec vec_splat(byte b){ return _mm_set1_epi8(char(b)); }
+static forceinline Vec vec_zero(){ return _mm_setzero_si128(); }
+static forceinline Vec vec_and(Vec a, Vec b){ return _mm_and_si128(a, b); }
+static forceinline Vec vec_or(Vec a, Vec b){ return _mm_or_si128(a, b); }
+static forceinline Vec vec_xor(Vec a, Vec b){ return _mm_xor_si128(a, b); }
+static forceinline Vec vec_subs(Vec a, Vec b){ return _mm_subs_epu8(a, b); }
+static forceinline bool vec_any(Vec v){ return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff; }
+static forceinline bool vec_is_ascii(Vec v){ return _mm_movemask_epi8(v) == 0; }
+static forceinline Vec vec_high_nibble(Vec v){ return _mm_and_si128(_mm_srli_epi16(v, 4), vec_splat(0x0f)); }
+static forceinline Vec vec_low_nibble(Vec v){ return _mm_and_si128(v, vec_splat(0x0f)); }
+static forceinline u32 vec_mask(Vec v){ return u32(_mm_movemask_epi8(v)); }
+static forceinline u32 vec_lead_mask(Vec v){ return u32(_mm_movemask_epi8(_mm_cmpgt_epi8(v, vec_splat(0xbf)))); }
+
+// Zero extend the 16 ASCII bytes at `p` to runes
+static forceinline
+void vec_widen_store(rune* out, byte const* p){
+	Vec v = vec_load(p);
+	Vec zero = vec_zero();
+	Vec lo = _mm_unpacklo_epi8(v, zero);
+	Vec hi = _mm_unpackhi_epi8(v, zero);
+	_mm_storeu_si128((Vec*)(out + 0),  _mm_unpacklo_epi16(lo, zero));
+	_mm_storeu_si128((Vec*)(out + 4),  _mm_unpackhi_epi16(lo, zero));
+	_mm_storeu_si128((Vec*)(out + 8),  _mm_unpacklo_epi16(hi, zero));
+	_mm_storeu_si128((Vec*)(out + 12), _mm_unpackhi_epi16(hi, zero));
+}
+
+#if defined(CORE_UTF8_LOOKUP)
+static forceinline
+Vec vec_lookup(Vec index, byte const (&table)[16]){
+	return _mm_shuffle_epi8(_mm_loadu_si128((Vec const*)table), index);
+}
+
+template<int N>
+static forceinline
+Vec vec_prev(Vec input, Vec prev){
+	return _mm_alignr_epi8(input, prev, 16 - N);
+}
+#endif
+#endif
+
+static forceinline
+i32 popcount(u32 x){
+	#if defined(COMPILER_MSVC)
+	return i32(__popcnt(x));
+	#else
+	return __builtin_popcount(x);
+	#endif
+}
+
+static forceinline
+i32 trailing_zeros(u32 x){
+	#if defined(COMPILER_MSVC)
+	unsigned long idx = 0;
+	_BitScanForward(&idx, x);
+	return i32(idx);
+	#else
+	return __builtin_ctz(x);
+	#endif
+}
+}
+#endif
+
+//// Vector validation
+// Lookup algorithm from "Validating UTF-8 In Less Than One Instruction Per
+// Byte" (Keiser, Lemire), as used by simdjson and simdutf. Every byte is
+// classified together with the byte before it through three 16-entry tables,
+// the surviving bits flag an error; 3 and 4 byte sequences are checked by
+// comparing how many continuation bytes are required against how many exist.
+#if defined(CORE_UTF8_LOOKUP)
+namespace utf8_lookup {
+using namespace utf8_vector;
+
+constexpr byte too_short   = 1 << 0; /* 11______ 0_______, 11______ 11______ */
+constexpr byte too_long    = 1 << 1; /* 0_______ 10______ */
+constexpr byte overlong_3  = 1 << 2; /* 11100000 100_____ */
+constexpr byte too_large   = 1 << 3; /* 11110100 1001____, 11110100 101_____, 11110101+ 1_______ */
+constexpr byte surrogate   = 1 << 4; /* 11101101 101_____ */
+constexpr byte overlong_2  = 1 << 5; /* 1100000_ 10______ */
+constexpr byte too_large_1000 = 1 << 6; /* 11110101+ 1000____ */
+constexpr byte overlong_4  = 1 << 6; /* 11110000 1000____ */
+constexpr byte two_conts   = 1 << 7; /* 10______ 10______ */
+constexpr byte carry = too_short | too_long | two_conts;
+
+constexpr byte byte_1_high[16] = {
+	/* 0_______ ________: ASCII lead */
+	too_long, too_long, too_long, too_long,
+	too_long, too_long, too_long, too_long,
+	/* 10______ ________: continuation lead */
+	two_conts, two_conts, two_conts, two_conts,
+	/* 1100____ ________ */
+	too_short | overlong_2,
+	/* 1101____ ________ */
+	too_short,
+	/* 1110____ ________ */
+	too_short | overlong_3 | surrogate,
+	/* 1111____ ________ */
+	too_short | too_large | too_large_1000 | overlong_4,
+};
+
+constexpr byte byte_1_low[16] = {
+	/* ____0000 ________ */
+	carry | overlong_3 | overlong_2 | overlong_4,
+	/* ____0001 ________ */
+	carry | overlong_2,
+	/* ____001_ ________ */
+	carry,
+	carry,
+	/* ____0100 ________ */
+	carry | too_large,
+	/* ____0101 ________ and up */
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+	/* ____1101 ________ */
+	carry | too_large | too_large_1000 | surrogate,
+	carry | too_large | too_large_1000,
+	carry | too_large | too_large_1000,
+};
+
+constexpr byte byte_2_high[16] = {
+	/* ________ 0_______ */
+	too_short, too_short, too_short, too_short,
+	too_short, too_short, too_short, too_short,
+	/* ________ 1000____ */
+	too_long | overlong_2 | two_conts | overlong_3 | too_large_1000 | overlong_4,
+	/* ________ 1001____ */
+	too_long | overlong_2 | two_conts | overlong_3 | too_large,
+	/* ________ 101_____ */
+	too_long | overlong_2 | two_conts | surrogate | too_large,
+	too_long | overlong_2 | two_conts | surrogate | too_large,
+	/* ________ 11______ */
+	too_short, too_short, too_short, too_short,
+};
+
+
+static forceinline
+Vec check_block(Vec input, Vec prev_input){
+	Vec prev1 = vec_prev<1>(input, prev_input);
+	Vec special = vec_and(vec_and(
+		vec_lookup(vec_high_nibble(prev1), byte_1_high),
+		vec_lookup(vec_low_nibble(prev1), byte_1_low)),
+		vec_lookup(vec_high_nibble(input), byte_2_high));
+
+	// Only 111_____ two bytes back or 1111____ three bytes back reach 0x80
+	Vec third  = vec_subs(vec_prev<2>(input, prev_input), vec_splat(0xe0 - 0x80));
+	Vec fourth = vec_subs(vec_prev<3>(input, prev_input), vec_splat(0xf0 - 0x80));
+	Vec must_continue = vec_and(vec_or(third, fourth), vec_splat(0x80));
+
+	return vec_xor(must_continue, special);
+}
+
+struct IncompleteLimits {
+	alignas(32) byte v[vec_width];
+};
+
+constexpr IncompleteLimits incomplete_limits = []{
+	IncompleteLimits l = {};
+	for(isize i = 0; i < vec_width; i += 1){ l.v[i] = 0xff; }
+	l.v[vec_width - 3] = 0xf0 - 1;
+	l.v[vec_width - 2] = 0xe0 - 1;
+	l.v[vec_width - 1] = 0xc0 - 1;
+	return l;
+}();
+
+// Non-zero where the block ends inside a multi byte sequence
+static forceinline
+Vec incomplete_tail(Vec input){
+	return vec_subs(input, vec_load(incomplete_limits.v));
+}
+}
+#endif
+
+isize utf8_valid_prefix(Slice<byte> buf){
+	isize i = 0;
+
+	#if defined(CORE_UTF8_LOOKUP)
+	using namespace utf8_lookup;
+	byte const* data = buf.data();
+	Vec prev_input = vec_zero();
+	Vec prev_incomplete = vec_zero();
+
+	for(; i + vec_width <= buf.len(); i += vec_width){
+		Vec input = vec_load(data + i);
+		Vec error;
+		if(vec_is_ascii(input)){
+			error = prev_incomplete;
+			prev_incomplete = vec_zero();
+		}
+		else {
+			error = check_block(input, prev_input);
+			prev_incomplete = incomplete_tail(input);
+		}
+		prev_input = input;
+
+		if(vec_any(error)){
+			break;
+		}
+	}
+
+	// Everything before a sequence that straddles into offset `i` has been
+	// validated, back up to its lead byte and let the scalar path finish
+	isize lead = i;
+	while(lead > 0 && i - lead < 3 && (data[lead - 1] & 0xc0) == 0x80){ lead -= 1; }
+	if(lead > 0 && data[lead - 1] >= 0xc0){ lead -= 1; }
+	i = lead;
+	#endif
+
+	return utf8_valid_prefix_scalar(buf, i);
+}
+
+//// Codepoint counting
+// Every byte that is not a continuation byte (10xx_xxxx) starts a codepoint
+static forceinline
+i32 utf8_word_lead_count(byte const* p){
+	u64 w;
+	mem_copy_no_overlap(&w, p, 8);
+	u64 continuation = w & ~(w << 1) & 0x8080'8080'8080'8080;
+	#if defined(COMPILER_MSVC)
+	return 8 - i32(__popcnt64(continuation));
+	#else
+	return 8 - __builtin_popcountll(continuation);
+	#endif
+}
+
+isize utf8_codepoint_count(Slice<byte> buf){
+	byte const* data = buf.data();
+	isize count = 0;
+	isize i = 0;
+
+	#if defined(CORE_UTF8_VECTOR)
+	using namespace utf8_vector;
+	for(; i + vec_width <= buf.len(); i += vec_width){
+		count += popcount(vec_lead_mask(vec_load(data + i)));
+	}
+	#endif
+
+	for(; i + 8 <= buf.len(); i += 8){
+		count += utf8_word_lead_count(data + i);
+	}
+	for(; i < buf.len(); i += 1){
+		count += !utf8_is_continuation_byte(data[i]);
+	}
+	return count;
+}
+
+isize utf8_codepoint_offset(Slice<byte> buf, isize n){
+	byte const* data = buf.data();
+	isize remaining = n;
+	isize i = 0;
+
+	if(n < 0){ return buf.len(); }
+
+	#if defined(CORE_UTF8_VECTOR)
+	using namespace utf8_vector;
+	for(; i + vec_width <= buf.len(); i += vec_width){
+		u32 leads = vec_lead_mask(vec_load(data + i));
+		isize count = popcount(leads);
+		if(remaining < count){
+			// Drop the leads before the one we want
+			for(isize k = 0; k < remaining; k += 1){ leads &= leads - 1; }
+			return i + trailing_zeros(leads);
+		}
+		remaining -= count;
+	}
+	#endif
+
+	for(; i + 8 <= buf.len(); i += 8){
+		isize count = utf8_word_lead_count(data + i);
+		if(remaining < count){ break; }
+		remaining -= count;
+	}
+	for(; i < buf.len(); i += 1){
+		if(utf8_is_continuation_byte(data[i])){ continue; }
+		if(remaining == 0){ return i; }
+		remaining -= 1;
+	}
+	return buf.len();
+}
+
+//// Bulk decoding
+// Windows of 2 and 3 byte sequences are decoded eight bytes at a time: every
+// byte is widened to a 32-bit lane and decoded as if it started a sequence,
+// then the lanes that hold continuation bytes are squeezed out. Only AVX2 gets
+// this path: with SSSE3 the eight lanes take two vectors and the squeeze two
+// shuffles, which measured slower than decoding one rune at a time.
+#if defined(CORE_UTF8_AVX2)
+namespace utf8_decode_vector {
+using namespace utf8_vector;
+
+struct Block {
+	isize bytes; /* 0 when the window holds a 4 byte sequence */
+	isize runes;
+};
+
+using Lanes = __m256i;
+
+// Lane indices of the set bits of every 8-bit mask, in order
+struct CompressTable {
+	alignas(8) byte v[256][8];
+};
+
+constexpr CompressTable compress_lanes = []{
+	CompressTable t = {};
+	for(isize mask = 0; mask < 256; mask += 1){
+		isize k = 0;
+		for(isize lane = 0; lane < 8; lane += 1){
+			if(mask & (1 << lane)){ t.v[mask][k++] = byte(lane); }
+		}
+	}
+	return t;
+}();
+
+static forceinline Lanes lanes_load(byte const* p){ return _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i const*)p)); }
+static forceinline Lanes lanes_splat(i32 v){ return _mm256_set1_epi32(v); }
+static forceinline Lanes lanes_and(Lanes a, Lanes b){ return _mm256_and_si256(a, b); }
+static forceinline Lanes lanes_or(Lanes a, Lanes b){ return _mm256_or_si256(a, b); }
+static forceinline Lanes lanes_less(Lanes a, Lanes b){ return _mm256_cmpgt_epi32(b, a); }
+static forceinline Lanes lanes_equal(Lanes a, Lanes b){ return _mm256_cmpeq_epi32(a, b); }
+static forceinline Lanes lanes_select(Lanes when, Lanes a, Lanes b){ return _mm256_blendv_epi8(b, a, when); }
+static forceinline u32 lanes_mask(Lanes v){ return u32(_mm256_movemask_ps(_mm256_castsi256_ps(v))); }
+template<int N> static forceinline Lanes lanes_shl(Lanes v){ return _mm256_slli_epi32(v, N); }
+
+// Store the lanes selected by `mask` next to each other
+static forceinline
+void lanes_compress_store(rune* out, Lanes v, u32 mask){
+	Lanes index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i const*)compress_lanes.v[mask]));
+	_mm256_storeu_si256((Lanes*)out, _mm256_permutevar8x32_epi32(v, index));
+}
+
+// Decode the sequences that start in the 8 bytes at `p`, which must start a
+// sequence and have at least 16 readable bytes. Writes up to 8 runes.
+static forceinline
+Block decode_block(rune* out, byte const* p){
+	Lanes b0 = lanes_load(p);
+	Lanes b1 = lanes_load(p + 1);
+	Lanes b2 = lanes_load(p + 2);
+
+	if(lanes_mask(lanes_less(lanes_splat(0xef), b0)) != 0){
+		return { 0, 0 };
+	}
+
+	Lanes low_1 = lanes_and(b1, lanes_splat(0x3f));
+	Lanes low_2 = lanes_and(b2, lanes_splat(0x3f));
+	Lanes two   = lanes_or(lanes_shl<6>(lanes_and(b0, lanes_splat(0x1f))), low_1);
+	Lanes three = lanes_or(lanes_or(lanes_shl<12>(lanes_and(b0, lanes_splat(0x0f))), lanes_shl<6>(low_1)), low_2);
+
+	Lanes runes = lanes_select(lanes_less(lanes_splat(0xdf), b0), three, two);
+	runes = lanes_select(lanes_less(b0, lanes_splat(0x80)), b0, runes);
+
+	u32 continuation = lanes_mask(lanes_equal(lanes_and(b0, lanes_splat(0xc0)), lanes_splat(0x80)));
+	u32 leads = ~continuation & 0xff;
+	lanes_compress_store(out, runes, leads);
+
+	// The last sequence may end up to two bytes past the window
+	isize bytes = 8;
+	while(bytes < 10 && utf8_is_continuation_byte(p[bytes])){ bytes += 1; }
+	return { bytes, popcount(leads) };
+}
+}
+#endif
+
+isize utf8_decode_all(Slice<byte> buf, Slice<rune> out){
+	byte const* data = buf.data();
+	rune* dest = out.data();
+	isize i = 0;
+	isize n = 0;
+
+	while(i < buf.len() && n < out.len()){
+		#if defined(CORE_UTF8_VECTOR)
+		{
+			using namespace utf8_vector;
+			// Runs of ASCII are widened a whole vector at a time
+			while(i + vec_width <= buf.len() && n + vec_width <= out.len() && vec_mask(vec_load(data + i)) == 0){
+				vec_widen_store(dest + n, data + i);
+				i += vec_width;
+				n += vec_width;
+			}
+		}
+		#endif
+
+		#if defined(CORE_UTF8_AVX2)
+		{
+			using namespace utf8_decode_vector;
+			// Then 2 and 3 byte sequences a block at a time, until a 4 byte one
+			// shows up or the text turns back to ASCII
+			bool ascii = false;
+			while(i + 16 <= buf.len() && n + 8 <= out.len()){
+				Block block = decode_block(dest + n, data + i);
+				if(block.bytes == 0){ break; }
+				i += block.bytes;
+				n += block.runes;
+				ascii = block.runes == 8 && block.bytes == 8;
+				if(ascii){ break; }
+			}
+			if(ascii){ continue; }
+		}
+		#endif
+
+		// Then up to the next vector of multi byte sequences one rune at a
+		// time, the tail of the buffer is decoded with checks
+		isize stop = i + 32;
+		while(i < buf.len() && n < out.len() && i < stop){
+			byte b = data[i];
+			if(b < 0x80){
+				dest[n++] = rune(b);
+				i += 1;
+				continue;
+			}
+
+			UTF8Decode d = (i + 4 <= buf.len())
+				? utf8_decode_unchecked(data + i)
+				: utf8_decode(buf[{i, buf.len()}]);
+			dest[n++] = d.codepoint;
+			i += d.len;
+		}
+	}
+	return n;
+}
+
+} /* Universal namespace */
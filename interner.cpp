@@ -0,0 +1,125 @@
+#include "interner.hpp"
+
+namespace kielo {
+
+u32 hash_identifier(Slice<byte> name){
+	constexpr u64 multiplier = 0x9e37'79b9'7f4a'7c15;
+	byte const* data = name.data();
+	u64 h = u64(name.len()) * multiplier;
+
+	isize i = 0;
+	for(; i + 8 <= name.len(); i += 8){
+		u64 word;
+		mem_copy_no_overlap(&word, data + i, 8);
+		h = (h ^ word) * multiplier;
+		h ^= h >> 32;
+	}
+	if(i < name.len()){
+		u64 word = 0;
+		mem_copy_no_overlap(&word, data + i, name.len() - i);
+		h = (h ^ word) * multiplier;
+		h ^= h >> 32;
+	}
+
+	return u32(h);
+}
+
+Interner Interner::create(Arena* arena, isize capacity){
+	isize slot_count = 16;
+	while(slot_count < capacity * 2){ slot_count *= 2; }
+
+	Interner interner;
+	interner.arena = arena;
+	interner.slots = arena->make<u32>(slot_count);
+	return interner;
+}
+
+static
+bool grow_slots(Interner* interner){
+	isize slot_count = max(isize(16), interner->slots.len() * 2);
+	auto slots = interner->arena->make<u32>(slot_count);
+	if(slots.len() != slot_count){ return false; }
+
+	u32 mask = u32(slot_count - 1);
+	for(isize s = 0; s < interner->count; s += 1){
+		u32 i = interner->hashes[s] & mask;
+		while(slots[i] != 0){ i = (i + 1) & mask; }
+		slots[i] = u32(s + 1);
+	}
+
+	interner->slots = slots;
+	return true;
+}
+
+static
+bool grow_entries(Interner* interner){
+	Arena* arena = interner->arena;
+	isize old_cap = interner->names.len();
+	isize new_cap = max(isize(64), old_cap * 2);
+
+	// Both arrays are grown before either is replaced, the arena never hands
+	// out old blocks again so the current ones stay valid when one fails
+	auto names  = (String*)arena->realloc(interner->names.data(), old_cap * sizeof(String), new_cap * sizeof(String), alignof(String));
+	auto hashes = (u32*)arena->realloc(interner->hashes.data(), old_cap * sizeof(u32), new_cap * sizeof(u32), alignof(u32));
+	if(names == nullptr || hashes == nullptr){ return false; }
+
+	interner->names  = Slice(names, new_cap);
+	interner->hashes = Slice(hashes, new_cap);
+	return true;
+}
+
+Maybe<Symbol> Interner::find(String name) const {
+	if(slots.len() == 0){ return {}; }
+
+	u32 hash = hash_identifier(name.raw_bytes());
+	u32 mask = u32(slots.len() - 1);
+	for(u32 i = hash & mask; slots[i] != 0; i = (i + 1) & mask){
+		Symbol s = slots[i] - 1;
+		if(hashes[s] == hash && names[s] == name){
+			return s;
+		}
+	}
+	return {};
+}
+
+Maybe<Symbol> Interner::intern(String name){
+	return intern(name, hash_identifier(name.raw_bytes()));
+}
+
+Maybe<Symbol> Interner::intern(String name, u32 hash){
+	// Keep the load factor at or below 1/2
+	if((count + 1) * 2 > slots.len()){
+		if(!grow_slots(this)){ return {}; }
+	}
+
+	u32 mask = u32(slots.len() - 1);
+	u32 i = hash & mask;
+	for(; slots[i] != 0; i = (i + 1) & mask){
+		Symbol s = slots[i] - 1;
+		if(hashes[s] == hash && names[s] == name){
+			return s;
+		}
+	}
+
+	if(count >= names.len()){
+		if(!grow_entries(this)){ return {}; }
+	}
+
+	auto bytes = arena->make<byte>(name.len());
+	if(bytes.len() != name.len()){ return {}; }
+	mem_copy_no_overlap(bytes.data(), name.data(), name.len());
+
+	Symbol s = Symbol(count);
+	names[s]  = String::from_bytes(bytes);
+	hashes[s] = hash;
+	slots[i]  = s + 1;
+	count += 1;
+	return s;
+}
+
+String Interner::name(Symbol s) const {
+	ensure_bounds_check(isize(s) < count, "Symbol does not belong to interner");
+	return names[s];
+}
+
+} /* Namespace */
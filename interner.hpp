@@ -0,0 +1,42 @@
+#pragma once
+
+#include "core/core.hpp"
+#include "core/memory.hpp"
+
+// Identifier interning. Each distinct identifier is stored once in an arena
+// and named by a dense 32-bit symbol id, numbered from 0 in order of first
+// appearance. Ids are stable for the lifetime of the interner, so one interner
+// can be shared by every file of a compilation to make symbols comparable
+// across them. Not thread safe.
+
+namespace kielo {
+using namespace core;
+
+using Symbol = u32;
+
+// Hash used by the interner, exposed so callers that already walk the bytes
+// can hash once and use intern(name, hash)
+u32 hash_identifier(Slice<byte> name);
+
+struct Interner {
+	Arena*        arena;  /* Owns identifier bytes and all tables */
+	Slice<u32>    slots;  /* Open addressing, holds symbol + 1, 0 is empty */
+	Slice<String> names;  /* Indexed by symbol */
+	Slice<u32>    hashes; /* Indexed by symbol */
+	isize         count;
+
+	// Symbol for `name`, adding it if it is new. Empty when the arena is full.
+	Maybe<Symbol> intern(String name);
+
+	Maybe<Symbol> intern(String name, u32 hash);
+
+	// Symbol for `name` if it has already been interned
+	Maybe<Symbol> find(String name) const;
+
+	String name(Symbol s) const;
+
+	static Interner create(Arena* arena, isize capacity = 1024);
+
+	Interner() : arena{nullptr}, slots{}, names{}, hashes{}, count{0} {}
+};
+}
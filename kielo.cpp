@@ -1,3 +1,8 @@
 #include "lexer.cpp"
+#include "scan.cpp"
+#include "numbers.cpp"
+#include "interner.cpp"
+#include "token_stream.cpp"
+#include "line_index.cpp"
+#include "stream_lexer.cpp"
 #include "parser.cpp"
-
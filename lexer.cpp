@@ -3,6 +3,9 @@
 #include "core/dynamic_array.hpp"
 
 #include "lexer.hpp"
+#include "scan.hpp"
+#include "numbers.hpp"
+#include "unicode_xid_tables.hpp"
 
 namespace kielo {
 Lexer Lexer::create(String source){
@@ -11,6 +14,29 @@ Lexer Lexer::create(String source){
 	return lex;
 }
 
+ErrorList ErrorList::create(Arena* arena){
+	ErrorList list;
+	list.arena = arena;
+	return list;
+}
+
+bool ErrorList::append(Error const& error){
+	if(count >= items.len()){
+		isize old_cap = items.len();
+		isize new_cap = max(isize(16), old_cap * 2);
+		auto data = (Error*)arena->realloc(items.data(), old_cap * sizeof(Error), new_cap * sizeof(Error), alignof(Error));
+		if(data == nullptr){ return false; }
+		items = Slice(data, new_cap);
+	}
+	items[count] = error;
+	count += 1;
+	return true;
+}
+
+Slice<Error> ErrorList::errors() const {
+	return items[{0, count}];
+}
+
 static inline
 bool is_decimal_digit(rune c){
 	return (c >= '0') && (c <= '9');
@@ -23,17 +49,49 @@ bool is_alpha(rune c){
 	return upper_ascii || lower_ascii;
 }
 
+static constexpr
+bool xid_lookup(XidTable const& table, rune c){
+	if(c < 0 || c >= xid_table_limit){ return false; }
+	u8 mid  = table.root[c >> 12];
+	u8 leaf = table.mids[mid][(c >> 7) & 31];
+	return (table.leaves[leaf][(c >> 6) & 1] >> (c & 63)) & 1;
+}
+
+static_assert(xid_lookup(xid_start_table, 0x00e9) && xid_lookup(xid_continue_table, 0x00e9), "XID table for U+00E9");
+static_assert(!xid_lookup(xid_start_table, 0x0301) && xid_lookup(xid_continue_table, 0x0301), "XID table for U+0301");
+static_assert(xid_lookup(xid_start_table, 0x4e00) && !xid_lookup(xid_continue_table, 0x3000), "XID table for U+4E00 and U+3000");
+static_assert(!xid_lookup(xid_start_table, 0xd800) && !xid_lookup(xid_continue_table, 0x10ffff), "XID table for non characters");
+
+// ASCII is checked first so plain source never touches the tables
+static inline
+bool is_identifier_start(rune c){
+	[[likely]] if(c < 0x80){
+		return is_alpha(c) || (c == '_');
+	}
+	return xid_lookup(xid_start_table, c);
+}
+
 static inline
 bool is_identifier_char(rune c){
-	auto upper_ascii = (c >= 'A') && (c <= 'Z');
-	auto lower_ascii = (c >= 'a') && (c <= 'z');
-	auto decimal = (c >= '0') && (c <= '9');
-	return upper_ascii || lower_ascii || decimal || (c == '_');
+	[[likely]] if(c < 0x80){
+		return is_alpha(c) || is_decimal_digit(c) || (c == '_');
+	}
+	return xid_lookup(xid_continue_table, c);
 }
 
 rune Lexer::peek(isize delta){
 	isize pos = current + delta;
 	if(pos >= source.len()){ return 0; }
+
+	#ifndef KIELO_DISABLE_ASCII_FAST_PATH
+	byte b = source.data()[pos];
+	[[likely]] if(b < 0x80){ return rune(b); }
+	#endif
+
+	if(utf8_validated && pos + 4 <= source.len()){
+		return utf8_decode_unchecked(source.data() + pos).codepoint;
+	}
+
 	auto [codepoint, _] = utf8_decode(source[{pos, source.len()}]);
 	return codepoint;
 }
@@ -58,14 +116,17 @@ Result<Token, Error> Lexer::consume_number(){
 		auto second = peek(1);
 		switch(second){
 			case 'b': case 'B':
-				panic("bin");
+				current += 2;
+				return consume_integer(2);
 			case 'o': case 'O':
-				panic("octal");
+				current += 2;
+				return consume_integer(8);
 			case 'x': case 'X':
-				panic("hex");
+				current += 2;
+				return consume_integer(16);
 		}
 
-		if(is_alpha(second)){
+		if(is_alpha(second) && second != 'e' && second != 'E'){
 			auto err = make_error(ErrorType::Lexer_InvalidBase);
 			// TODO: Better message
 			return err;
@@ -75,45 +136,228 @@ Result<Token, Error> Lexer::consume_number(){
 	return consume_decimal();
 }
 
-Token Lexer::consume_decimal(){ panic("decimal"); }
+Result<Token, Error> Lexer::consume_decimal(){
+	isize end = current + scan_digits_end(source[{current, source.len()}], 10);
+
+	bool fraction = end + 1 < source.len() && source[end] == '.' && is_decimal_digit(source[end + 1]);
+	bool exponent = end < source.len() && (source[end] == 'e' || source[end] == 'E');
+	if(fraction || exponent){
+		current = end;
+		return consume_real();
+	}
+
+	return consume_integer(10);
+}
+
+Result<Token, Error> Lexer::consume_real(){
+	if(peek() == '.'){
+		current += 1;
+		current += scan_digits_end(source[{current, source.len()}], 10);
+	}
+
+	if(peek() == 'e' || peek() == 'E'){
+		current += 1;
+		if(peek() == '+' || peek() == '-'){
+			current += 1;
+		}
+
+		isize n = scan_digits_end(source[{current, source.len()}], 10);
+		if(n == 0){
+			return make_error(ErrorType::Lexer_MissingDigits);
+		}
+		current += n;
+	}
+
+	if(is_identifier_char(peek())){
+		return make_error(ErrorType::Lexer_InvalidDigit);
+	}
+
+	auto value = parse_decimal_float(source[{previous, current}]);
+	if(!value.ok()){
+		return make_error(ErrorType::Lexer_RealOverflow);
+	}
+
+	auto token = make_token(TokenType::Real);
+	token.value.real = value.unwrap();
+	return token;
+}
+
+Result<Token, Error> Lexer::consume_integer(i32 base){
+	ensure(base == 2 || base == 8 || base == 10 || base == 16, "Invalid base");
+
+	isize n = scan_digits_end(source[{current, source.len()}], base);
+	if(n == 0){
+		return make_error(ErrorType::Lexer_MissingDigits);
+	}
+
+	auto digits = source[{current, current + n}];
+	current += n;
+
+	if(is_identifier_char(peek())){
+		return make_error(ErrorType::Lexer_InvalidDigit);
+	}
+
+	auto value = parse_digits(digits, base);
+	if(!value.ok()){
+		return make_error(ErrorType::Lexer_IntegerOverflow);
+	}
+
+	auto token = make_token(TokenType::Integer);
+	token.value.integer = i64(value.unwrap());
+	return token;
+}
+
+static inline
+i32 hex_digit_value(byte c){
+	if(c >= '0' && c <= '9'){ return c - '0'; }
+	byte lower = c | 0x20;
+	if(lower >= 'a' && lower <= 'f'){ return lower - 'a' + 10; }
+	return -1;
+}
+
+// Decodes the body of a string literal that is known to be terminated and to
+// contain at least one escape. Writes at most `body.len()` bytes to `out`,
+// returns the decoded length or the offset (negated, minus one) of the bad
+// escape inside `body`.
+static
+isize decode_escapes(Slice<byte> body, byte* out){
+	isize n = 0;
+	isize i = 0;
+
+	while(i < body.len()){
+		isize run = scan_string_end(body[{i, body.len()}]);
+		mem_copy_no_overlap(out + n, body.data() + i, run);
+		n += run;
+		i += run;
+		if(i >= body.len()){ break; }
+
+		isize escape = i;
+		i += 1; /* Backslash */
+		byte c = i < body.len() ? body[i] : 0;
+		i += 1;
+
+		switch(c){
+			case 'n':  out[n++] = '\n'; continue;
+			case 't':  out[n++] = '\t'; continue;
+			case 'r':  out[n++] = '\r'; continue;
+			case '0':  out[n++] = 0;    continue;
+			case '\\': out[n++] = '\\'; continue;
+			case '"':  out[n++] = '"';  continue;
+			case '\'': out[n++] = '\''; continue;
+
+			case 'x': {
+				i32 hi = i + 1 < body.len() ? hex_digit_value(body[i]) : -1;
+				i32 lo = i + 1 < body.len() ? hex_digit_value(body[i + 1]) : -1;
+				/* Restricted to ASCII so decoded strings stay valid UTF-8 */
+				if(hi < 0 || lo < 0 || hi > 7){ return -escape - 1; }
+				out[n++] = byte(hi * 16 + lo);
+				i += 2;
+			} continue;
+
+			case 'u': {
+				if(i >= body.len() || body[i] != '{'){ return -escape - 1; }
+				i += 1;
+
+				rune codepoint = 0;
+				isize digits = 0;
+				for(; i < body.len() && body[i] != '}'; i += 1, digits += 1){
+					i32 d = hex_digit_value(body[i]);
+					if(d < 0 || digits >= 6){ return -escape - 1; }
+					codepoint = codepoint * 16 + d;
+				}
+				if(i >= body.len() || digits == 0){ return -escape - 1; }
+				i += 1; /* Closing brace */
+
+				auto encoded = utf8_encode(codepoint);
+				if(encoded.len == 0){ return -escape - 1; }
+				/* An escape is at least as long as its encoding, `out` cannot overflow */
+				mem_copy_no_overlap(out + n, encoded.bytes, encoded.len);
+				n += encoded.len;
+			} continue;
+		}
 
-Token Lexer::consume_integer(i32 base){
-	constexpr auto is_hex = [](rune c) -> bool {
-		return (c >= '0' && c < '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f');
-	};
-	constexpr auto is_oct = [](rune c) -> bool {
-		return (c >= '0' && c < '7');
-	};
-	constexpr auto is_bin = [](rune c) -> bool {
-		return (c >= '0' && c < '7');
-	};
+		return -escape - 1;
+	}
 
-	using DigitFn = bool (*)(rune);
+	return n;
+}
 
-	DigitFn valid_digit = nullptr;
+Result<Token, Error> Lexer::consume_string(){
+	// `current` is right after the opening quote
+	isize start = current;
+	bool has_escapes = false;
 
-	switch(base){
-		case 2:  valid_digit = is_bin; break;
-		case 8:  valid_digit = is_oct; break;
-		case 16: valid_digit = is_hex; break;
+	for(;;){
+		current += scan_string_end(source[{current, source.len()}]);
+		if(current >= source.len() || source[current] == '\n'){
+			return make_error(ErrorType::Lexer_UnterminatedString);
+		}
+		if(source[current] == '"'){ break; }
+
+		has_escapes = true;
+		current += 2; /* Skip the escaped byte, it may be a quote */
+		if(current > source.len()){
+			current = source.len();
+			return make_error(ErrorType::Lexer_UnterminatedString);
+		}
 	}
-	ensure(valid_digit != nullptr, "Invalid base");
 
-	auto region = scratch->create_region();
-	defer(region.release());
-	auto digits = DynamicArray<rune>::create(scratch, 128);
+	auto body = source[{start, current}];
+	current += 1; /* Closing quote */
+
+	auto token = make_token(TokenType::String);
+	if(!has_escapes){
+		token.value.text = String::from_bytes(body);
+		return token;
+	}
 
-	panic("--");
+	// Decoded text is never longer than the source text, allocate that much
+	// and give back the difference
+	Arena* arena = scratch ? scratch : thread_arena();
+	byte* out = (byte*)arena->alloc(body.len(), 1);
+	if(out == nullptr){
+		return make_error(ErrorType::Lexer_OutOfMemory);
+	}
+
+	isize n = decode_escapes(body, out);
+	if(n < 0){
+		arena->resize_in_place(out, 0);
+		current = start + (-n - 1);
+		return make_error(ErrorType::Lexer_BadEscape);
+	}
+	arena->resize_in_place(out, n);
+
+	token.value.text = String::from_bytes(Slice<byte>(out, n));
+	return token;
 }
 
 rune Lexer::advance(){
 	if(current >= source.len()){ return 0; }
 
+	#ifndef KIELO_DISABLE_ASCII_FAST_PATH
+	byte b = source.data()[current];
+	[[likely]] if(b < 0x80){
+		current += 1;
+		return rune(b);
+	}
+	#endif
+
+	if(utf8_validated && current + 4 <= source.len()){
+		auto [codepoint, n] = utf8_decode_unchecked(source.data() + current);
+		current += n;
+		return codepoint;
+	}
+
 	auto [codepoint, n] = utf8_decode(source[{current, source.len()}]);
 	current += n;
 	return codepoint;
 }
 
+bool Lexer::validate_utf8(){
+	utf8_validated = utf8_valid_prefix(source) == source.len();
+	return utf8_validated;
+}
+
 void Lexer::rewind(){
 	if(current <= 0){ return; }
 	current -= 1;
@@ -122,63 +366,224 @@ void Lexer::rewind(){
 	}
 }
 
+// Keywords are resolved through a perfect hash of (first byte, last byte,
+// length). The multiplier is searched at compile time so that every keyword
+// lands in its own slot, an identifier then costs one hash and at most one
+// comparison.
+namespace keyword_hashing {
+using T = TokenType;
+
+constexpr Pair<String, TokenType> keywords[] = {
+	{"if",       T::If},
+	{"else",     T::Else},
+	{"for",      T::For},
+	{"break",    T::Break},
+	{"continue", T::Continue},
+	{"fn",       T::Fn},
+	{"return",   T::Return},
+	{"match",    T::Match},
+	{"let",      T::Let},
+	{"const",    T::Const},
+	{"struct",   T::Struct},
+	{"true",     T::True},
+	{"false",    T::False},
+};
+
+constexpr isize keyword_count = sizeof(keywords) / sizeof(keywords[0]);
+
+constexpr isize min_len = 2;
+constexpr isize max_len = 8;
+
+constexpr u32 table_bits = 5;
+constexpr u32 table_size = 1 << table_bits;
+static_assert(keyword_count <= table_size, "Keyword table is too small");
+
+constexpr
+u32 hash(byte first, byte last, isize len, u32 seed){
+	u32 key = (u32(first) << 16) | (u32(last) << 8) | u32(len);
+	return (key * seed) >> (32 - table_bits);
+}
+
+constexpr
+u32 hash(String s, u32 seed){
+	return hash(byte(s.data()[0]), byte(s.data()[s.len() - 1]), s.len(), seed);
+}
+
+constexpr
+u32 find_seed(){
+	for(u32 seed = 0x9e37'79b1; seed < 0x9e37'79b1 + 100'000; seed += 2){
+		bool used[table_size] = {};
+		bool ok = true;
+		for(isize i = 0; i < keyword_count && ok; i += 1){
+			u32 h = hash(keywords[i].a, seed);
+			ok = !used[h];
+			used[h] = true;
+		}
+		if(ok){ return seed; }
+	}
+	return 0;
+}
+
+constexpr u32 seed = find_seed();
+static_assert(seed != 0, "Could not find a perfect hash for the keyword set");
+
+struct Table {
+	String     names[table_size];
+	TokenType  types[table_size];
+};
+
+constexpr
+Table build_table(){
+	Table t = {};
+	for(isize i = 0; i < keyword_count; i += 1){
+		u32 h = hash(keywords[i].a, seed);
+		t.names[h] = keywords[i].a;
+		t.types[h] = keywords[i].b;
+	}
+	return t;
+}
+
+constexpr Table table = build_table();
+}
+
 static inline
 Maybe<TokenType> keyword_of(String s){
-	using T = TokenType;
-	constexpr Pair<String, TokenType> keywords[] = {
-		{"if",       T::If},
-		{"else",     T::Else},
-		{"for",      T::For},
-		{"break",    T::Break},
-		{"continue", T::Continue},
-		{"fn",       T::Fn},
-		{"return",   T::Return},
-		{"match",    T::Match},
-		{"let",      T::Let},
-		{"struct",   T::Struct},
-	};
-
-	constexpr isize N = sizeof(keywords) / sizeof(keywords[0]);
-
-	for(isize i = 0; i < N; i += 1){
-		if(s == keywords[i].a){
-			return keywords[i].b;
-		}
+	using namespace keyword_hashing;
+	if(s.len() < min_len || s.len() > max_len){ return {}; }
+
+	u32 h = hash(s, seed);
+	String candidate = table.names[h];
+	if(candidate.len() == s.len() && mem_compare(candidate.data(), s.data(), s.len()) == 0){
+		return table.types[h];
 	}
 	return {};
 }
 
-
-Token Lexer::consume_identifier(){
+Result<Token, Error> Lexer::consume_identifier(){
 	previous = current;
+	current += scan_identifier_end(source[{current, source.len()}]);
 
-	for(;;){
-		rune c = advance();
-		if(!is_identifier_char(c)){
-			rewind();
+	// Non ASCII identifier characters, decoded one at a time between ASCII runs
+	while(current < source.len() && source[current] >= 0x80){
+		isize start = current;
+		if(!is_identifier_char(advance())){
+			current = start;
 			break;
 		}
+		current += scan_identifier_end(source[{current, source.len()}]);
 	}
 
 	auto token = make_token(TokenType::Unknown);
 	token.type = keyword_of(token.lexeme).or_else(TokenType::Identifier);
+
+	if(interner != nullptr && token.type == TokenType::Identifier){
+		auto symbol = interner->intern(token.lexeme);
+		if(!symbol.ok()){
+			return make_error(ErrorType::Lexer_OutOfMemory);
+		}
+		token.value.symbol = symbol.unwrap();
+	}
 	return token;
 }
 
+Result<Token, Error> Lexer::next(){
+	trivia_start = current;
+	if(trivia == TriviaMode::Skip){
+		skip_trivia();
+	}
+
+	auto res = next_token();
+	if(res.ok() || errors == nullptr){
+		return res;
+	}
+
+	Error error = res.unwrap_error();
+	if(!synchronize(error)){
+		return error;
+	}
+	if(!errors->append(error)){
+		return make_error(ErrorType::Lexer_OutOfMemory);
+	}
+	return make_token(TokenType::Unknown);
+}
+
+bool Lexer::synchronize(Error const& error){
+	using E = ErrorType;
+	switch(error.type){
+		case E::None:
+		case E::Lexer_OutOfMemory:
+		case E::Lexer_TokenTooLong:
+		case E::Lexer_StreamError:
+		case E::Parser_UnexpectedToken:
+		case E::Parser_ExpectedExpression:
+		case E::Parser_ExpectedType:
+		case E::Parser_ExpectedDeclaration:
+		case E::Parser_NestingTooDeep:
+		case E::Parser_OutOfMemory:
+			return false;
+
+		case E::Lexer_BadCodepoint:
+		case E::Lexer_UnterminatedString:
+			/* Already past the codepoint, or at the end of the line */
+			break;
+
+		case E::Lexer_BadEscape:
+			/* The literal is terminated, skip to its closing quote */
+			for(;;){
+				current += scan_string_end(source[{current, source.len()}]);
+				if(current >= source.len() || source[current] == '"'){ break; }
+				current += 2;
+			}
+			current = min(current + 1, i64(source.len()));
+			break;
+
+		case E::Lexer_InvalidBase:
+		case E::Lexer_MissingDigits:
+		case E::Lexer_InvalidDigit:
+		case E::Lexer_IntegerOverflow:
+		case E::Lexer_RealOverflow:
+			/* The rest of the word is part of the bad literal */
+			if(current <= previous){ advance(); }
+			while(current < source.len() && is_identifier_char(peek())){
+				advance();
+			}
+			break;
+	}
+
+	if(current <= previous){
+		advance();
+	}
+	return true;
+}
+
+void Lexer::skip_trivia(){
+	while(current < source.len()){
+		byte c = source[current];
+
+		if(c == ' ' || c == '\t' || c == '\n' || c == '\r'){
+			current += scan_whitespace_end(source[{current, source.len()}]);
+		}
+		else if(c == '/' && current + 1 < source.len() && source[current + 1] == '/'){
+			isize end = current + 2 + scan_line_end(source[{current + 2, source.len()}]);
+			current = min(end + 1, source.len());
+		}
+		else {
+			break;
+		}
+	}
+}
+
 Token Lexer::consume_line_comment(){
-    previous = current;
+	previous = current;
 
-    for(;;){
-        rune c = advance();
-        if(c == '\n' || c == 0){
-            break;
-        }
-    }
-    
-    auto res = make_token(TokenType::LineComment);
+	isize end = current + scan_line_end(source[{current, source.len()}]);
+	current = min(end + 1, source.len());
+
+	auto res = make_token(TokenType::LineComment);
 
 	// Include double-slash and ignore line-feed
-	res.lexeme = String::from_bytes(source[{previous-2, current-1}]);
+	res.start = previous - 2;
+	res.lexeme = String::from_bytes(source[{previous-2, end}]);
 	return res;
 }
 
@@ -194,14 +599,161 @@ Token Lexer::make_token(TokenType t){
 	Token token;
 	token.type = t;
 	token.lexeme = String::from_bytes(source[{previous, current}]);
+	token.start = previous;
 	token.offset = current;
+	token.trivia_start = trivia_start;
 	return token;
 }
 
+#if defined(KIELO_LEXER_DFA)
+// Table driven backend: punctuators are recognised by a DFA built at compile
+// time from the punctuator list, bytes are first mapped to a character class
+// and each class moves the machine to its next state. Every state is an
+// accepting one, so the longest match is found in one pass without
+// backtracking.
+namespace punctuator_dfa {
+using T = TokenType;
+
+constexpr Pair<String, TokenType> punctuators[] = {
+	{"(",  T::ParenOpen},   {")",  T::ParenClose},
+	{"[",  T::SquareOpen},  {"]",  T::SquareClose},
+	{"{",  T::CurlyOpen},   {"}",  T::CurlyClose},
+	{".",  T::Dot},         {"^",  T::Caret},
+	{":",  T::Colon},       {";",  T::Semicolon},
+	{",",  T::Comma},       {"~",  T::Tilde},
+
+	{"+",  T::Plus},        {"+=", T::PlusAssign},
+	{"-",  T::Minus},       {"-=", T::MinusAssign},  {"->", T::ArrowRight},
+	{"*",  T::Star},        {"*=", T::StarAssign},
+	{"/",  T::Slash},       {"/=", T::SlashAssign},  {"//", T::LineComment},
+	{"%",  T::Mod},         {"%=", T::ModAssign},
+
+	{"=",  T::Assign},      {"==", T::Equal},
+	{"!",  T::LogicNot},    {"!=", T::NotEqual},
+	{">",  T::Greater},     {">=", T::GreaterEqual}, {">>", T::ShiftRight},
+	{"<",  T::Less},        {"<=", T::LessEqual},    {"<<", T::ShiftLeft},
+	{"&",  T::And},         {"&=", T::AndAssign},    {"&&", T::LogicAnd},
+	{"|",  T::Or},          {"|=", T::OrAssign},     {"||", T::LogicOr},
+};
+
+constexpr isize punctuator_count = sizeof(punctuators) / sizeof(punctuators[0]);
+
+constexpr isize max_states  = 64;
+constexpr isize max_classes = 32;
+
+struct Machine {
+	u8 byte_class[256];
+	u8 transitions[max_states][max_classes];
+	TokenType accept[max_states];
+	isize state_count;
+	isize class_count;
+};
+
+// State 0 is the start state and class 0 is "not a punctuator", its row and
+// column are left empty so any unknown byte stops the machine.
+constexpr
+Machine build_machine(){
+	Machine m = {};
+	m.state_count = 1;
+	m.class_count = 1;
+
+	for(isize i = 0; i < punctuator_count; i += 1){
+		String p = punctuators[i].a;
+		u8 state = 0;
+		for(isize j = 0; j < p.len(); j += 1){
+			byte c = byte(p.data()[j]);
+			if(m.byte_class[c] == 0){
+				m.byte_class[c] = u8(m.class_count++);
+			}
+			u8& next = m.transitions[state][m.byte_class[c]];
+			if(next == 0){
+				next = u8(m.state_count++);
+			}
+			state = next;
+		}
+		m.accept[state] = punctuators[i].b;
+	}
+	return m;
+}
+
+constexpr Machine machine = build_machine();
+
+static_assert(machine.state_count <= max_states && machine.class_count <= max_classes, "DFA tables are too small");
+
+constexpr
+bool every_state_accepts(){
+	for(isize s = 1; s < machine.state_count; s += 1){
+		if(machine.accept[s] == T::Unknown){ return false; }
+	}
+	return true;
+}
+
+static_assert(every_state_accepts(), "Punctuator prefixes must be tokens themselves, the DFA does not backtrack");
+
+static inline
+Pair<TokenType, isize> match(Slice<byte> buf){
+	byte const* data = buf.data();
+	u8 state = 0;
+	isize n = 0;
+	for(; n < buf.len(); n += 1){
+		u8 next = machine.transitions[state][machine.byte_class[data[n]]];
+		if(next == 0){ break; }
+		state = next;
+	}
+	return { machine.accept[state], n };
+}
+}
+
+Result<Token, Error> Lexer::next_token(){
+	previous = current;
+
+	if(current >= source.len()){
+		return make_token(TokenType::EndOfFile);
+	}
+
+	auto [punct, len] = punctuator_dfa::match(source[{current, source.len()}]);
+	if(punct != TokenType::Unknown){
+		current += len;
+		if(punct == TokenType::LineComment){
+			return consume_line_comment();
+		}
+		return make_token(punct);
+	}
+
+	// A NUL byte ends the source, like in the switch backend
+	rune c = advance();
+	if(c == 0){
+		return make_token(TokenType::EndOfFile);
+	}
+
+	Token token;
+	if(c == '"'){
+		return consume_string();
+	}
+	else if(c == '\n' || c == '\r' || c == '\t' || c == ' '){
+		current += scan_whitespace_end(source[{current, source.len()}]);
+		token = make_token(TokenType::Whitespace);
+	}
+	else if(is_decimal_digit(c)){
+		rewind();
+		return consume_number();
+	}
+	else if(is_identifier_start(c)){
+		rewind();
+		return consume_identifier();
+	}
+
+	if(token.type == TokenType::Unknown)
+		return make_error(ErrorType::Lexer_BadCodepoint);
+	else
+		return token;
+}
+
+#else
 #define MATCH_NEXT(Char, Expr) if(advance_matching(Char)){ token = (Expr); break; }
 #define MATCH_DEFAULT(Expr) { token = (Expr); break; }
 
-Result<Token, Error> Lexer::next(){
+Result<Token, Error> Lexer::next_token(){
 	Token token;
 	previous = current;
 
@@ -299,19 +851,20 @@ Result<Token, Error> Lexer::next(){
 			MATCH_DEFAULT(make_token(T::LogicNot));
 
 		case '"':
-			panic("Unimplemented: string");
+			return consume_string();
 
 		case '\n': case '\r': case '\t': case ' ':
-			token = make_token(T::Whitespace);
+			current += scan_whitespace_end(source[{current, source.len()}]);
+			MATCH_DEFAULT(make_token(T::Whitespace));
 
 		default:
 			if(is_decimal_digit(c)){
 				rewind();
 				return consume_number();
 			}
-			else if(is_identifier_char(c)){
+			else if(is_identifier_start(c)){
 				rewind();
-				token = consume_identifier();
+				return consume_identifier();
 			}
 		break;
 	}
@@ -324,5 +877,6 @@ Result<Token, Error> Lexer::next(){
 
 #undef MATCH_NEXT
 #undef MATCH_DEFAULT
+#endif
 
 } /* Namespace */
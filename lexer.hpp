@@ -2,6 +2,9 @@
 
 #include "core/core.hpp"
 #include "core/memory.hpp"
+#include "core/stream.hpp"
+
+#include "interner.hpp"
 
 namespace kielo {
 using namespace core;
@@ -84,15 +87,24 @@ union TokenValue {
 	f64    real;
 	i64    integer;
 	String text;
+	Symbol symbol; /* Identifiers, when the lexer has an interner */
 };
 
 struct Token {
 	String lexeme;
 	TokenType type;
-	i64 offset;
+	i64 start;  /* Offset of the first byte */
+	i64 offset; /* Offset right after the token, past the line feed that ends a line comment */
+	i64 trivia_start; /* Start of the whitespace and comments skipped before the token */
 	TokenValue value;
 
-	Token() : lexeme{""}, type{0}, offset{0}, value{i64(0)} {}
+	Token() : lexeme{""}, type{0}, start{0}, offset{0}, trivia_start{0}, value{i64(0)} {}
+};
+
+// How the lexer reports whitespace and comments
+enum class TriviaMode : u8 {
+	Tokens, /* As Whitespace and LineComment tokens */
+	Skip,   /* Skipped in bulk, Token::trivia_start keeps their range */
 };
 
 enum class ErrorType : u32 {
@@ -100,6 +112,22 @@ enum class ErrorType : u32 {
 
 	Lexer_BadCodepoint,
 	Lexer_InvalidBase,
+	Lexer_OutOfMemory,
+	Lexer_TokenTooLong,
+	Lexer_StreamError,
+	Lexer_MissingDigits,
+	Lexer_InvalidDigit,
+	Lexer_IntegerOverflow,
+	Lexer_RealOverflow,
+	Lexer_UnterminatedString,
+	Lexer_BadEscape,
+
+	Parser_UnexpectedToken,
+	Parser_ExpectedExpression,
+	Parser_ExpectedType,
+	Parser_ExpectedDeclaration,
+	Parser_NestingTooDeep,
+	Parser_OutOfMemory,
 };
 
 struct Error {
@@ -109,12 +137,33 @@ struct Error {
 	String message = "";
 };
 
+// Errors collected in an arena by the recovering modes, in the order they
+// were found
+struct ErrorList {
+	Arena*       arena;
+	Slice<Error> items; /* Capacity, the first `count` are in use */
+	isize        count;
+
+	// False when the arena is full
+	bool append(Error const& error);
+
+	Slice<Error> errors() const;
+
+	static ErrorList create(Arena* arena);
+
+	ErrorList() : arena{nullptr}, items{}, count{0} {}
+};
 
 struct Lexer {
 	i64 current;
 	i64 previous;
 	Slice<byte> source;
 	Arena* scratch;
+	Interner* interner; /* Optional, identifiers get a symbol when set */
+	TriviaMode trivia;
+	i64 trivia_start;
+	bool utf8_validated; /* Source is known to be valid UTF-8, decode without checks */
+	ErrorList* errors; /* Optional, when set errors are recorded here and returned as Unknown tokens */
 
 	rune advance();
 
@@ -130,21 +179,203 @@ struct Lexer {
 
 	Result<Token, Error> next();
 
+	Result<Token, Error> next_token();
+
+	// Move `current` past the malformed text that caused `error`, to where the
+	// next token can start. Returns false for errors that cannot be recovered
+	// from (out of memory, stream failures).
+	bool synchronize(Error const& error);
+
+	// Move past any whitespace and line comments at `current`
+	void skip_trivia();
+
+	// Validate the whole source once so decoding can skip the per rune checks.
+	// Returns false, keeping checked decoding, when it is not valid UTF-8.
+	bool validate_utf8();
+
 	Token consume_line_comment();
 
-	Token consume_identifier();
+	Result<Token, Error> consume_identifier();
 
 	Result<Token, Error> consume_number();
 
-	Token consume_decimal();
+	Result<Token, Error> consume_decimal();
+
+	Result<Token, Error> consume_real();
+
+	Result<Token, Error> consume_integer(i32 base);
 
-	Token consume_integer(i32 base);
+	Result<Token, Error> consume_string();
 
 	static Lexer create(String source);
 
-	Lexer() : current{0}, previous{0}, source{} {}
+	Lexer() : current{0}, previous{0}, source{}, scratch{nullptr}, interner{nullptr}, trivia{TriviaMode::Tokens}, trivia_start{0}, utf8_validated{false}, errors{nullptr} {}
 };
 
+// Lexer that pulls its input from a Stream through a fixed size window, so
+// memory stays bounded regardless of input size. When a token (or a UTF-8
+// sequence) could continue past the bytes currently in the window, the pending
+// bytes are moved to the front, the window is refilled and the token is lexed
+// again. Offsets are global, but lexemes point into the window and are only
+// valid until the next call to next().
+//
+// Trivia never has to fit in the window. With TriviaMode::Skip it is dropped
+// from the window as it is skipped. With TriviaMode::Tokens whitespace and
+// line comments longer than the window are split at the window end into
+// several tokens of the same type, the pieces after the first one of a comment
+// do not start with `//`. Every other token has to fit in the window together
+// with the codepoint after it, or next() fails with Lexer_TokenTooLong.
+struct StreamLexer {
+	Lexer lexer;
+	Stream* input;
+	Slice<byte> window;
+	i64 window_start; /* Global offset of window[0] */
+	isize filled;
+	bool at_end;
+	bool failed;
+	bool in_comment; /* The last token was a line comment split at the window end */
+	ErrorList* errors; /* Optional, same as Lexer::errors but with global offsets */
+
+	Result<Token, Error> next();
+
+	bool refill();
+
+	void skip_trivia();
+
+	Token comment_rest();
+
+	static StreamLexer create(Stream* input, Slice<byte> window);
+
+	StreamLexer() : lexer{}, input{nullptr}, window{}, window_start{0}, filled{0}, at_end{false}, failed{false}, in_comment{false}, errors{nullptr} {}
+};
+
+// 1-based line and column of a byte offset, columns count codepoints
+struct Position {
+	i64 line;
+	i64 column;
+};
+
+// Maps byte offsets to line and column. The table of line starts is built the
+// first time a position is requested and kept for the lifetime of the index,
+// every lookup after that is a binary search.
+struct LineIndex {
+	Slice<byte> source;
+	Arena*      arena;
+	Slice<u32>  line_starts; /* Offset of the first byte of every line */
+	bool        built;
+
+	Position position(i64 offset);
+
+	// Position of the first byte of the token
+	Position position(Token const& token);
+
+	Position position(Error const& error);
+
+	isize line_count();
+
+	static LineIndex create(Arena* arena, String source);
+
+	LineIndex() : source{}, arena{nullptr}, line_starts{}, built{false} {}
+};
+
+// Dense structure-of-arrays storage for a whole token sequence. Only the type
+// and start offset of each token are kept. Lexeme lengths follow from where
+// the next token starts, literal values are recovered by re-lexing a token
+// from its offset and cached in a side table the first time one is requested.
+// With TriviaMode::Skip the offset where the skipped trivia before each token
+// starts is kept as well, so consumers that want the trivia back (formatters,
+// doc comments) can slice it from text() as [trivia_start(i), offset(i)).
+//
+// relex() edits a stream in place. The source keeps a gap of unused bytes
+// where lexing last restarted and the columns one of unused entries after the
+// last re-lexed token, so an edit only moves what lies between it and the
+// previous one. Past the gap offsets are stored counted back from the end of
+// the text, which edits before them do not change. Read the columns through
+// the accessors. Lexemes and tokens point into `source` and are valid until
+// the next edit or call to text().
+struct TokenStream {
+	Slice<byte> source;
+	Slice<u8>   types;
+	Slice<u32>  offsets;
+	Slice<u32>  trivia_starts; /* TriviaMode::Skip only, empty otherwise */
+	isize       count;
+	Arena*      arena;
+	TriviaMode  trivia;
+	isize       gap;      /* Tokens from here on are stored at the end of the columns */
+	isize       text_gap; /* Where the unused bytes of `source` start */
+	isize       text_len; /* Bytes of text in `source`, the rest is the gap */
+
+	// Side tables, filled on demand
+	Slice<u32>        literal_tokens; /* Sorted token indices of literals, then `count` */
+	Slice<TokenValue> literal_values;
+	LineIndex         lines;
+
+	TokenType type(isize i) const;
+
+	u32 offset(isize i) const;
+
+	// TriviaMode::Skip only
+	u32 trivia_start(isize i) const;
+
+	u32 length(isize i) const;
+
+	String lexeme(isize i) const;
+
+	TokenValue value(isize i);
+
+	Token token(isize i) const;
+
+	Position position(isize i);
+
+	// The whole text, the gap in `source` is moved past its end first
+	String text();
+
+	TokenStream() : source{}, types{}, offsets{}, trivia_starts{}, count{0}, arena{nullptr}, trivia{TriviaMode::Tokens}, gap{0}, text_gap{0}, text_len{0} {}
+};
+
+// Lex all of `source` into a TokenStream allocated from `arena`, stops at the
+// first error. With TriviaMode::Skip the stream holds no whitespace or comment
+// tokens. When `errors` is given lexing recovers instead, malformed text
+// becomes Unknown tokens and every error is appended to the list (which must
+// not live in thread_arena(), that is used as scratch space).
+Result<TokenStream, Error> tokenize_all(Arena* arena, String source, TriviaMode trivia = TriviaMode::Tokens, ErrorList* errors = nullptr);
+
+// Same as tokenize_all, but the source is split at line boundaries and the
+// chunks are lexed concurrently by up to `thread_count` workers (0 means one
+// per hardware thread). Chunk starts are speculative: when a token from the
+// previous chunk runs past a boundary the stitcher re-lexes until both streams
+// agree on a token start again.
+Result<TokenStream, Error> tokenize_all_parallel(Arena* arena, String source, isize thread_count = 0, TriviaMode trivia = TriviaMode::Tokens);
+
+// Replace `removed` bytes at `offset` with `inserted`
+struct TextEdit {
+	i64         offset;
+	i64         removed;
+	Slice<byte> inserted;
+};
+
+// Tokens [first, old_end) of the stream before the edit became tokens
+// [first, new_end), the ones after are the old tokens shifted by the size
+// change
+struct Relexed {
+	isize first;
+	isize old_end;
+	isize new_end;
+};
+
+// Apply `edit` to the source of `stream` and update its tokens in place.
+// Lexing restarts at the last token the edit cannot have affected and stops as
+// soon as a new token starts where an old one did past the edit, from there on
+// the old tokens are kept. With `errors` the re-lexed range recovers from
+// errors like tokenize_all does. On failure the stream is left as it was.
+//
+// Apart from the lexing an edit costs moving the gaps from the previous edit.
+// The first edit copies the source into the arena of the stream, since it
+// belongs to the caller, and a gap without room for the edit moves the stream
+// to buffers from the arena an eighth bigger than needed. Side tables are
+// dropped and built again on first use.
+Result<Relexed, Error> relex(TokenStream* stream, TextEdit edit, ErrorList* errors = nullptr);
+
 // Maybe<String> into_string(Token t, Slice<byte> buf){ }
 
 constexpr static inline
@@ -0,0 +1,91 @@
+#include "core/core.hpp"
+#include "core/memory.hpp"
+
+#include "lexer.hpp"
+#include "scan.hpp"
+
+namespace kielo {
+
+LineIndex LineIndex::create(Arena* arena, String source){
+	ensure(source.len() < isize(0xffff'ffff), "Source is too big for 32-bit line offsets");
+
+	LineIndex index;
+	index.source = source.raw_bytes();
+	index.arena  = arena;
+	return index;
+}
+
+static
+bool build_line_starts(LineIndex* index){
+	isize count = count_line_feeds(index->source) + 1;
+
+	index->line_starts = index->arena ? index->arena->make<u32>(count) : Slice<u32>{};
+	if(index->line_starts.len() != count){
+		index->line_starts = {};
+		return false;
+	}
+
+	index->line_starts[0] = 0;
+	collect_line_starts(index->source, index->line_starts[{1, count}]);
+	return true;
+}
+
+isize LineIndex::line_count(){
+	if(!built){
+		built = build_line_starts(this);
+	}
+	if(!built){
+		return count_line_feeds(source) + 1;
+	}
+	return line_starts.len();
+}
+
+Position LineIndex::position(i64 offset){
+	offset = clamp(i64(0), offset, i64(source.len()));
+
+	if(!built){
+		built = build_line_starts(this);
+	}
+
+	isize line = 0;
+	isize line_start = 0;
+
+	if(built){
+		// Last line that starts at or before `offset`
+		isize lo = 0, hi = line_starts.len();
+		while(hi - lo > 1){
+			isize mid = lo + (hi - lo) / 2;
+			if(i64(line_starts[mid]) <= offset){ lo = mid; }
+			else { hi = mid; }
+		}
+		line = lo;
+		line_start = line_starts[lo];
+	}
+	else {
+		// No memory for the table, count from the start every time
+		auto prefix = source[{0, offset}];
+		line = count_line_feeds(prefix);
+		for(line_start = offset; line_start > 0 && source[line_start - 1] != '\n'; line_start -= 1){}
+	}
+
+	isize column = utf8_codepoint_count(source[{line_start, offset}]);
+	return Position{ .line = line + 1, .column = column + 1 };
+}
+
+Position LineIndex::position(Token const& token){
+	return position(token.start);
+}
+
+Position LineIndex::position(Error const& error){
+	return position(error.offset);
+}
+
+Position TokenStream::position(isize i){
+	ensure_bounds_check(i >= 0 && i < count, "Index to token stream is out of bounds");
+	if(lines.arena == nullptr){
+		lines = LineIndex::create(arena, text()); /* Dropped by relex */
+	}
+	return lines.position(offset(i));
+}
+
+} /* Namespace */
@@ -8,13 +8,6 @@
 
 using namespace core;
 
-Arena* thread_arena(){
-	constexpr isize thread_arena_size = 1 * 1024 * 1024;
-	thread_local byte thread_arena_memory[thread_arena_size];
-	thread_local Arena arena = Arena::create(Slice(&thread_arena_memory[0], thread_arena_size));
-	return &arena;
-}
-
 int main(){
 	auto nums = thread_arena()->make<u64>(30);
 	for(isize i = 0; i < nums.len(); i++){
@@ -0,0 +1,545 @@
+#include "numbers.hpp"
+#include "numbers_pow10.hpp"
+
+#if !defined(KIELO_DISABLE_SWAR)
+	#if defined(COMPILER_MSVC) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+		#define KIELO_SWAR 1
+	#endif
+#endif
+
+namespace kielo {
+
+static inline
+i32 digit_value(byte c){
+	if(c >= '0' && c <= '9'){ return c - '0'; }
+	byte lower = c | 0x20;
+	if(lower >= 'a' && lower <= 'f'){ return lower - 'a' + 10; }
+	return 99;
+}
+
+static inline
+i32 base_bits(i32 base){
+	switch(base){
+		case 2:  return 1;
+		case 8:  return 3;
+		case 16: return 4;
+	}
+	return 0;
+}
+
+#if defined(KIELO_SWAR)
+namespace swar {
+constexpr u64 ones = 0x0101'0101'0101'0101;
+constexpr u64 high = 0x8080'8080'8080'8080;
+
+static forceinline
+u64 load8(byte const* p){
+	u64 v;
+	mem_copy_no_overlap(&v, p, 8);
+	return v;
+}
+
+// High bit set in every byte lane holding a value in [lo, hi], lanes must be ASCII
+static forceinline
+u64 in_range(u64 v, byte lo, byte hi){
+	u64 ge = v + ones * (128 - lo);
+	u64 le = v + ones * (127 - hi);
+	return ge & ~le & high;
+}
+
+static forceinline
+u64 digit_mask(u64 v, i32 base){
+	u64 m = 0;
+	if(base == 16){
+		m = in_range(v, '0', '9') | in_range(v, 'a', 'f') | in_range(v, 'A', 'F');
+	}
+	else {
+		m = in_range(v, '0', '0' + base - 1);
+	}
+	return m & ~(v & high);
+}
+
+// Combine 8 digit characters, first one being the most significant, into their value
+static forceinline
+u64 parse8(u64 v, u64 base){
+	if(base == 16){
+		v = (v & (ones * 0x0f)) + 9 * ((v >> 6) & ones);
+	}
+	else {
+		v -= ones * '0';
+	}
+	v = (v * base + (v >> 8)) & 0x00ff'00ff'00ff'00ff;
+	v = (v * (base * base) + (v >> 16)) & 0x0000'ffff'0000'ffff;
+	v = (v * (base * base * base * base) + (v >> 32)) & 0xffff'ffff;
+	return v;
+}
+
+static forceinline
+i32 trailing_zeros(u64 x){
+	#if defined(COMPILER_MSVC)
+	unsigned long idx = 0;
+	_BitScanForward64(&idx, x);
+	return i32(idx);
+	#else
+	return __builtin_ctzll(x);
+	#endif
+}
+}
+#endif
+
+isize scan_digits_end(Slice<byte> buf, i32 base){
+	byte const* data = buf.data();
+	isize i = 0;
+
+	#if defined(KIELO_SWAR)
+	for(; i + 8 <= buf.len(); i += 8){
+		u64 m = swar::digit_mask(swar::load8(data + i), base);
+		if(m != swar::high){
+			return i + swar::trailing_zeros(~m & swar::high) / 8;
+		}
+	}
+	#endif
+
+	while(i < buf.len() && digit_value(data[i]) < base){
+		i += 1;
+	}
+	return i;
+}
+
+Maybe<u64> parse_digits(Slice<byte> digits, i32 base){
+	byte const* data = digits.data();
+	isize n = digits.len();
+
+	// Leading zeros do not count towards the overflow limits
+	isize i = 0;
+	while(i < n && data[i] == '0'){ i += 1; }
+	isize significant = n - i;
+
+	if(base == 10){
+		// 19 digits always fit in a u64, so only the final value needs checking
+		if(significant > 19){ return {}; }
+	}
+	else {
+		i32 bits = base_bits(base);
+		if(significant > 0){
+			i32 first = digit_value(data[i]);
+			i32 first_bits = 0;
+			while(first >> first_bits){ first_bits += 1; }
+			if((significant - 1) * bits + first_bits > 64){ return {}; }
+		}
+	}
+
+	u64 value = 0;
+
+	#if defined(KIELO_SWAR)
+	u64 chunk_scale = 1;
+	for(isize k = 0; k < 8; k += 1){ chunk_scale *= u64(base); }
+
+	for(; i + 8 <= n; i += 8){
+		// For base 16 a full chunk shifts by 32 bits, which is fine as the
+		// digit count was checked above
+		value = value * chunk_scale + swar::parse8(swar::load8(data + i), u64(base));
+	}
+	#endif
+
+	for(; i < n; i += 1){
+		value = value * u64(base) + u64(digit_value(data[i]));
+	}
+
+	if(base == 10 && value > u64(0x7fff'ffff'ffff'ffff)){
+		return {};
+	}
+	return value;
+}
+
+//// Floating point
+namespace float_parsing {
+constexpr i32 max_mantissa_digits = 19;
+constexpr i32 exponent_limit = 100'000;
+constexpr i32 float_bias = 1023;
+constexpr u64 mantissa_mask = (u64(1) << 52) - 1;
+
+struct Decomposed {
+	u64  mantissa;  /* Up to 19 significant digits */
+	i64  exponent;  /* Power of ten applied to mantissa */
+	bool truncated; /* Non-zero digits were dropped from mantissa */
+};
+
+static forceinline
+f64 f64_from_bits(u64 bits){
+	f64 v;
+	mem_copy_no_overlap(&v, &bits, sizeof(v));
+	return v;
+}
+
+static forceinline
+void mul128(u64 a, u64 b, u64* hi, u64* lo){
+	#if defined(COMPILER_MSVC)
+	*lo = _umul128(a, b, hi);
+	#else
+	unsigned __int128 p = (unsigned __int128)a * b;
+	*hi = u64(p >> 64);
+	*lo = u64(p);
+	#endif
+}
+
+static forceinline
+i32 leading_zeros(u64 x){
+	#if defined(COMPILER_MSVC)
+	unsigned long idx = 0;
+	_BitScanReverse64(&idx, x);
+	return 63 - i32(idx);
+	#else
+	return __builtin_clzll(x);
+	#endif
+}
+
+static
+i64 parse_exponent(Slice<byte> text, isize* pos){
+	isize i = *pos;
+	if(i >= text.len() || (text[i] | 0x20) != 'e'){ return 0; }
+	i += 1;
+
+	bool negative = false;
+	if(i < text.len() && (text[i] == '+' || text[i] == '-')){
+		negative = text[i] == '-';
+		i += 1;
+	}
+
+	i64 e = 0;
+	for(; i < text.len() && text[i] >= '0' && text[i] <= '9'; i += 1){
+		if(e < exponent_limit){ e = e * 10 + (text[i] - '0'); }
+	}
+	*pos = i;
+	return negative ? -e : e;
+}
+
+static
+Decomposed decompose(Slice<byte> text){
+	Decomposed d = {};
+	isize digits = 0;
+	isize i = 0;
+
+	auto push_digit = [&](byte c, bool fraction){
+		if(d.mantissa == 0 && c == '0'){
+			d.exponent -= fraction;
+		}
+		else if(digits < max_mantissa_digits){
+			d.mantissa = d.mantissa * 10 + (c - '0');
+			d.exponent -= fraction;
+			digits += 1;
+		}
+		else {
+			d.exponent += !fraction;
+			d.truncated |= c != '0';
+		}
+	};
+
+	for(; i < text.len() && text[i] >= '0' && text[i] <= '9'; i += 1){
+		push_digit(text[i], false);
+	}
+	if(i < text.len() && text[i] == '.'){
+		for(i += 1; i < text.len() && text[i] >= '0' && text[i] <= '9'; i += 1){
+			push_digit(text[i], true);
+		}
+	}
+	d.exponent += parse_exponent(text, &i);
+	return d;
+}
+
+// Exact when both the mantissa and the power of ten are exactly
+// representable, a single IEEE operation then rounds correctly.
+static
+Maybe<f64> clinger_fast_path(Decomposed d){
+	constexpr f64 exact_powers[] = {
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+
+	if(d.truncated || d.mantissa > (u64(1) << 53) || d.exponent < -22 || d.exponent > 22){
+		return {};
+	}
+
+	f64 v = f64(d.mantissa);
+	if(d.exponent < 0){ return v / exact_powers[-d.exponent]; }
+	return v * exact_powers[d.exponent];
+}
+
+// Eisel-Lemire: scale the normalised mantissa by a 128-bit approximation of
+// the power of ten. Gives up (empty) when the truncated product cannot
+// decide the rounding, or the result is subnormal or infinite.
+static
+Maybe<f64> eisel_lemire(u64 mantissa, i64 exp10){
+	if(mantissa == 0){ return 0.0; }
+	if(exp10 < pow10_table_min_exp || exp10 > pow10_table_max_exp){ return {}; }
+
+	auto const& pow10 = pow10_table[exp10 - pow10_table_min_exp];
+
+	i32 clz = leading_zeros(mantissa);
+	mantissa <<= clz;
+	u64 exp2 = u64(((217706 * exp10) >> 16) + 64 + float_bias) - u64(clz);
+
+	u64 hi, lo;
+	mul128(mantissa, pow10[1], &hi, &lo);
+
+	// The low bits may be off, widen the approximation with the low half of
+	// the power of ten
+	if((hi & 0x1ff) == 0x1ff && lo + mantissa < mantissa){
+		u64 y_hi, y_lo;
+		mul128(mantissa, pow10[0], &y_hi, &y_lo);
+		u64 merged_hi = hi;
+		u64 merged_lo = lo + y_hi;
+		if(merged_lo < lo){ merged_hi += 1; }
+		if((merged_hi & 0x1ff) == 0x1ff && merged_lo + 1 == 0 && y_lo + mantissa < mantissa){
+			return {};
+		}
+		hi = merged_hi;
+		lo = merged_lo;
+	}
+
+	u64 msb = hi >> 63;
+	u64 result = hi >> (msb + 9);
+	exp2 -= 1 ^ msb;
+
+	// Exactly halfway between two floats, the approximation cannot tell
+	if(lo == 0 && (hi & 0x1ff) == 0 && (result & 3) == 1){
+		return {};
+	}
+
+	result += result & 1;
+	result >>= 1;
+	if(result >> 53 > 0){
+		result >>= 1;
+		exp2 += 1;
+	}
+
+	if(exp2 - 1 >= 0x7ff - 1){
+		return {};
+	}
+
+	return f64_from_bits((exp2 << 52) | (result & mantissa_mask));
+}
+
+// Simple decimal conversion: the literal is held as a big decimal number and
+// scaled by powers of two until its binary exponent is known, then the
+// mantissa bits are extracted with round-half-even. Slow, but exact for any
+// input and it only uses a fixed buffer.
+struct BigDecimal {
+	static constexpr isize max_digits = 800;
+	static constexpr u32 max_shift = 60;
+
+	byte digits[max_digits]; /* Values 0-9, most significant first */
+	isize count;
+	isize point;    /* Position of the decimal point relative to digits[0] */
+	bool truncated; /* Non-zero digits beyond the buffer were dropped */
+
+	void trim(){
+		while(count > 0 && digits[count - 1] == 0){ count -= 1; }
+		if(count == 0){ point = 0; }
+	}
+
+	void left_shift(u32 k){
+		byte out[max_digits + 24];
+		isize w = isize(sizeof(out));
+		u64 n = 0;
+
+		for(isize r = count - 1; r >= 0; r -= 1){
+			n += u64(digits[r]) << k;
+			out[--w] = byte(n % 10);
+			n /= 10;
+		}
+		while(n > 0){
+			out[--w] = byte(n % 10);
+			n /= 10;
+		}
+
+		isize produced = isize(sizeof(out)) - w;
+		isize kept = min(produced, max_digits);
+		for(isize i = kept; i < produced; i += 1){
+			truncated |= out[w + i] != 0;
+		}
+
+		mem_copy_no_overlap(digits, out + w, kept);
+		point += produced - count;
+		count = kept;
+		trim();
+	}
+
+	void right_shift(u32 k){
+		isize r = 0;
+		isize w = 0;
+		u64 n = 0;
+
+		// Pick up enough leading digits to cover the first shift
+		for(; (n >> k) == 0; r += 1){
+			if(r >= count){
+				if(n == 0){
+					count = 0;
+					return;
+				}
+				while((n >> k) == 0){
+					n *= 10;
+					r += 1;
+				}
+				break;
+			}
+			n = n * 10 + digits[r];
+		}
+		point -= r - 1;
+
+		u64 mask = (u64(1) << k) - 1;
+		for(; r < count; r += 1){
+			u64 c = digits[r];
+			digits[w++] = byte(n >> k);
+			n &= mask;
+			n = n * 10 + c;
+		}
+
+		while(n > 0){
+			u64 digit = n >> k;
+			n &= mask;
+			if(w < max_digits){
+				digits[w++] = byte(digit);
+			}
+			else if(digit > 0){
+				truncated = true;
+			}
+			n *= 10;
+		}
+
+		count = w;
+		trim();
+	}
+
+	void shift(i32 k){
+		if(count == 0){ return; }
+		for(; k > i32(max_shift); k -= max_shift){ left_shift(max_shift); }
+		for(; k < -i32(max_shift); k += max_shift){ right_shift(max_shift); }
+		if(k > 0){ left_shift(u32(k)); }
+		if(k < 0){ right_shift(u32(-k)); }
+	}
+
+	bool should_round_up(isize nd) const {
+		if(nd < 0 || nd >= count){ return false; }
+		if(digits[nd] == 5 && nd + 1 == count){
+			if(truncated){ return true; }
+			return nd > 0 && (digits[nd - 1] % 2) == 1;
+		}
+		return digits[nd] >= 5;
+	}
+
+	u64 rounded_integer() const {
+		if(point > 20){ return ~u64(0); }
+		u64 n = 0;
+		isize i = 0;
+		for(; i < point && i < count; i += 1){ n = n * 10 + digits[i]; }
+		for(; i < point; i += 1){ n *= 10; }
+		if(should_round_up(point)){ n += 1; }
+		return n;
+	}
+
+	static void read(BigDecimal* d, Slice<byte> text){
+		d->count = 0;
+		d->point = 0;
+		d->truncated = false;
+
+		bool saw_dot = false;
+		isize i = 0;
+		for(; i < text.len(); i += 1){
+			byte c = text[i];
+			if(c == '.'){
+				saw_dot = true;
+				d->point = d->count;
+				continue;
+			}
+			if(c < '0' || c > '9'){ break; }
+
+			if(c == '0' && d->count == 0){
+				d->point -= 1; /* Leading zero */
+				continue;
+			}
+			if(d->count < max_digits){
+				d->digits[d->count++] = c - '0';
+			}
+			else if(c != '0'){
+				d->truncated = true;
+			}
+		}
+		if(!saw_dot){ d->point = d->count; }
+		d->point += parse_exponent(text, &i);
+	}
+};
+
+static
+Maybe<f64> big_decimal_fallback(Slice<byte> text){
+	constexpr i32 powers_of_two[] = {1, 3, 6, 9, 13, 16, 19, 23, 26};
+	constexpr isize power_count = sizeof(powers_of_two) / sizeof(powers_of_two[0]);
+
+	BigDecimal d;
+	BigDecimal::read(&d, text);
+
+	if(d.count == 0 || d.point < -330){ return 0.0; }
+	if(d.point > 310){ return {}; }
+
+	// Scale into [0.5, 1)
+	i32 exp = 0;
+	while(d.point > 0){
+		i32 n = d.point >= power_count ? 27 : powers_of_two[d.point];
+		d.shift(-n);
+		exp += n;
+	}
+	while(d.point < 0 || (d.point == 0 && d.digits[0] < 5)){
+		i32 n = -d.point >= power_count ? 27 : powers_of_two[-d.point];
+		d.shift(n);
+		exp -= n;
+	}
+
+	// [0.5, 1) to [1, 2)
+	exp -= 1;
+
+	// Below the smallest normal exponent, denormalise
+	constexpr i32 min_exp = 1 - float_bias;
+	if(exp < min_exp){
+		d.shift(-(min_exp - exp));
+		exp = min_exp;
+	}
+	if(exp + float_bias >= 0x7ff){ return {}; }
+
+	d.shift(53);
+	u64 mantissa = d.rounded_integer();
+
+	if(mantissa == (u64(2) << 52)){
+		mantissa >>= 1;
+		exp += 1;
+		if(exp + float_bias >= 0x7ff){ return {}; }
+	}
+
+	i32 biased = (mantissa & (u64(1) << 52)) ? exp + float_bias : 0;
+	return f64_from_bits((u64(biased) << 52) | (mantissa & mantissa_mask));
+}
+}
+
+Maybe<f64> parse_decimal_float(Slice<byte> text){
+	using namespace float_parsing;
+	Decomposed d = decompose(text);
+
+	auto fast = clinger_fast_path(d);
+	if(fast.ok()){ return fast.unwrap(); }
+
+	auto approx = eisel_lemire(d.mantissa, d.exponent);
+	if(approx.ok()){
+		if(!d.truncated){ return approx.unwrap(); }
+
+		// Dropped digits put the true value between mantissa and mantissa+1
+		auto upper = eisel_lemire(d.mantissa + 1, d.exponent);
+		if(upper.ok()){
+			f64 a = approx.unwrap();
+			f64 b = upper.unwrap();
+			if(a == b){ return a; }
+		}
+	}
+
+	return big_decimal_fallback(text);
+}
+
+} /* Namespace */
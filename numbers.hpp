@@ -0,0 +1,24 @@
+#pragma once
+
+#include "core/core.hpp"
+
+// Numeric literal helpers used by the lexer. Digit runs are validated and
+// converted 8 bytes at a time with SWAR (SIMD within a register) arithmetic,
+// define KIELO_DISABLE_SWAR to use the plain one digit at a time loops.
+
+namespace kielo {
+using namespace core;
+
+// Length of the run of valid digits for `base` (2, 8, 10 or 16) at the start of `buf`
+isize scan_digits_end(Slice<byte> buf, i32 base);
+
+// Value of a run of valid digits. Base 10 must fit in an i64, other bases may
+// use all 64 bits. Empty on overflow.
+Maybe<u64> parse_digits(Slice<byte> digits, i32 base);
+
+// Correctly rounded value of a well formed decimal literal of the form
+// `digits [. digits] [(e|E) [+|-] digits]`. Tries an exact fast path, then
+// Eisel-Lemire, then falls back to big decimal arithmetic on the stack. Empty
+// if the value overflows to infinity.
+Maybe<f64> parse_decimal_float(Slice<byte> text);
+}
@@ -0,0 +1,1102 @@
+#include "core/core.hpp"
+#include "core/memory.hpp"
+#include "core/dynamic_array.hpp"
+#include "core/thread.hpp"
+
+#include "parser.hpp"
+
+namespace kielo {
+
+NodeKind Ast::kind(NodeIndex i) const {
+	return kinds[i];
+}
+
+u32 Ast::main_token(Declaration decl, NodeIndex i) const {
+	return decl.first_token + main_tokens[i];
+}
+
+NodeData Ast::children(NodeIndex i) const {
+	return data[i];
+}
+
+Node Ast::node(Declaration decl, NodeIndex i) const {
+	NodeData d = data[i];
+	return Node{ .kind = kinds[i], .token = main_token(decl, i), .lhs = d.lhs, .rhs = d.rhs };
+}
+
+Slice<u32> Ast::list(u32 start, u32 end) const {
+	return extra[{start, end}];
+}
+
+Slice<Declaration> Ast::declarations() const {
+	return roots[{0, root_count}];
+}
+
+// Recursive descent for declarations and statements, precedence climbing
+// (Pratt) for expressions. The first error is recorded in the parser and from
+// then on the current token reads as EndOfFile, so every loop ends and the
+// recursion unwinds without checking for errors at each call. In recovering
+// mode the unwinding stops at the nearest declaration or statement loop,
+// which skips to a synchronisation point and carries on.
+namespace parsing {
+using T = TokenType;
+using K = NodeKind;
+
+// Deeper nesting is reported as an error instead of overflowing the stack
+constexpr i32 max_depth = 256;
+
+// Binding power of infix operators, 0 for tokens that are not one
+enum Precedence : i32 {
+	precedence_none = 0,
+	precedence_assign,         /* = += -= *= /= %= &= |=, right associative */
+	precedence_logic_or,       /* || */
+	precedence_logic_and,      /* && */
+	precedence_compare,        /* == != < > <= >= */
+	precedence_bit_or,         /* | */
+	precedence_bit_and,        /* & */
+	precedence_shift,          /* << >> */
+	precedence_additive,       /* + - */
+	precedence_multiplicative, /* * / % */
+	precedence_prefix,         /* - ! ~ &, binds tighter than any infix operator */
+};
+
+static inline
+i32 infix_precedence(TokenType t){
+	switch(t){
+		case T::Assign: case T::PlusAssign: case T::MinusAssign: case T::StarAssign:
+		case T::SlashAssign: case T::ModAssign: case T::AndAssign: case T::OrAssign:
+			return precedence_assign;
+
+		case T::LogicOr:  return precedence_logic_or;
+		case T::LogicAnd: return precedence_logic_and;
+
+		case T::Equal: case T::NotEqual: case T::Greater: case T::Less:
+		case T::GreaterEqual: case T::LessEqual:
+			return precedence_compare;
+
+		case T::Or:  return precedence_bit_or;
+		case T::And: return precedence_bit_and;
+
+		case T::ShiftLeft: case T::ShiftRight:
+			return precedence_shift;
+
+		case T::Plus: case T::Minus:
+			return precedence_additive;
+
+		case T::Star: case T::Slash: case T::Mod:
+			return precedence_multiplicative;
+
+		default:
+			return precedence_none;
+	}
+}
+
+struct Parser {
+	TokenStream* tokens;
+	isize        current;    /* Next significant token */
+	u32          token_base; /* First token of the declaration being parsed */
+	i32          depth;
+	bool         failed;
+	Error        error;
+	ErrorList*   errors;     /* Recovering mode when set */
+
+	DynamicArray<NodeKind>    kinds;
+	DynamicArray<u32>         main_tokens;
+	DynamicArray<NodeData>    data;
+	DynamicArray<u32>         extra;
+	DynamicArray<u32>         scratch; /* Elements of unfinished lists, innermost last */
+	DynamicArray<Declaration> roots;
+};
+
+static inline
+bool is_trivia(TokenType t){
+	return t == T::Whitespace || t == T::LineComment;
+}
+
+static inline
+void skip_trivia(Parser* p){
+	while(p->current < p->tokens->count - 1 && is_trivia(p->tokens->type(p->current))){
+		p->current += 1;
+	}
+}
+
+static inline
+TokenType peek(Parser* p){
+	if(p->failed){ return T::EndOfFile; }
+	return p->tokens->type(p->current);
+}
+
+static
+void fail(Parser* p, ErrorType t){
+	if(p->failed){ return; }
+	p->failed = true;
+	p->error.type = t;
+	p->error.offset = p->tokens->offset(p->current);
+
+	if(p->errors && t != ErrorType::Parser_OutOfMemory && !p->errors->append(p->error)){
+		p->error.type = ErrorType::Parser_OutOfMemory;
+	}
+}
+
+// Index of the current token, then move to the next significant one. The
+// final EndOfFile token is never passed.
+static inline
+u32 advance(Parser* p){
+	u32 token = u32(p->current);
+	if(p->current < p->tokens->count - 1){
+		p->current += 1;
+		skip_trivia(p);
+	}
+	return token;
+}
+
+static inline
+bool accept(Parser* p, TokenType t){
+	if(peek(p) == t){
+		advance(p);
+		return true;
+	}
+	return false;
+}
+
+static inline
+u32 expect(Parser* p, TokenType t){
+	if(peek(p) != t){
+		fail(p, ErrorType::Parser_UnexpectedToken);
+		return u32(p->current);
+	}
+	return advance(p);
+}
+
+static
+NodeIndex add_node(Parser* p, NodeKind kind, u32 token, u32 lhs = 0, u32 rhs = 0){
+	NodeIndex index = NodeIndex(p->kinds.len());
+	p->kinds.append(kind);
+	p->main_tokens.append(token - p->token_base);
+	p->data.append(NodeData{ .lhs = lhs, .rhs = rhs });
+	if(p->kinds.len() == index || p->main_tokens.len() == index || p->data.len() == index){
+		fail(p, ErrorType::Parser_OutOfMemory);
+	}
+	return index;
+}
+
+static
+u32 add_extra(Parser* p, u32 value){
+	u32 index = u32(p->extra.len());
+	p->extra.append(value);
+	if(p->extra.len() == index){ fail(p, ErrorType::Parser_OutOfMemory); }
+	return index;
+}
+
+static
+void push(Parser* p, NodeIndex node){
+	isize len = p->scratch.len();
+	p->scratch.append(node);
+	if(p->scratch.len() == len){ fail(p, ErrorType::Parser_OutOfMemory); }
+}
+
+// Move the list elements pushed since `mark` to `extra`, returns their range
+static
+Pair<u32, u32> finish_list(Parser* p, isize mark){
+	u32 start = u32(p->extra.len());
+	for(isize i = mark; i < p->scratch.len(); i += 1){
+		add_extra(p, p->scratch[i]);
+	}
+	while(p->scratch.len() > mark){
+		p->scratch.pop();
+	}
+	return { start, u32(p->extra.len()) };
+}
+
+static
+bool enter(Parser* p){
+	if(p->depth >= max_depth){
+		fail(p, ErrorType::Parser_NestingTooDeep);
+		return false;
+	}
+	p->depth += 1;
+	return true;
+}
+
+static inline
+void leave(Parser* p){
+	p->depth -= 1;
+}
+
+//// Recovery
+// Parser state before a declaration or statement, to roll back to when it
+// fails
+struct Checkpoint {
+	isize token;
+	isize nodes;
+	isize extra;
+};
+
+static inline
+Checkpoint checkpoint(Parser* p){
+	return { .token = p->current, .nodes = p->kinds.len(), .extra = p->extra.len() };
+}
+
+// Skip tokens up to the next synchronisation point: past a `;` or past the
+// `}` that closes the braces the broken code opened, or before a `}` or a
+// `fn`/`struct` keyword, at the starting brace depth. At the top level a `}`
+// has no block to end, so it is skipped as well, and `const`/`let` start the
+// next declaration.
+static
+void synchronize(Parser* p, i32 depth, bool top_level){
+	for(;;){
+		switch(peek(p)){
+			case T::EndOfFile:
+				return;
+
+			case T::CurlyOpen:
+				depth += 1;
+				break;
+
+			case T::CurlyClose:
+				if(depth == 0){
+					if(top_level){ advance(p); }
+					return;
+				}
+				depth -= 1;
+				if(depth == 0){
+					advance(p);
+					return;
+				}
+				break;
+
+			case T::Semicolon:
+				if(depth == 0){
+					advance(p);
+					return;
+				}
+				break;
+
+			case T::Fn: case T::Struct:
+				if(depth == 0){ return; }
+				break;
+
+			case T::Const: case T::Let:
+				if(depth == 0 && top_level){ return; }
+				break;
+
+			default: break;
+		}
+		advance(p);
+	}
+}
+
+// Panic mode: called by the declaration and statement loops once the parser
+// has failed. Drops the nodes built since `from`, skips the rest of the broken
+// code and returns an Error node to stand in for it. Without an error list,
+// or out of memory, the parser stays failed and 0 is returned.
+static
+NodeIndex recover(Parser* p, Checkpoint const& from, bool top_level){
+	if(p->errors == nullptr || p->error.type == ErrorType::Parser_OutOfMemory){
+		return 0;
+	}
+
+	while(p->kinds.len() > from.nodes){
+		p->kinds.pop();
+		p->main_tokens.pop();
+		p->data.pop();
+	}
+	while(p->extra.len() > from.extra){
+		p->extra.pop();
+	}
+
+	// Braces opened by the broken code are closed before synchronising
+	i32 depth = 0;
+	for(isize i = from.token; i < p->current; i += 1){
+		TokenType t = p->tokens->type(i);
+		depth += i32(t == T::CurlyOpen) - i32(t == T::CurlyClose);
+	}
+
+	p->failed = false;
+	synchronize(p, max(depth, 0), top_level);
+	if(p->current == from.token){
+		advance(p);
+	}
+	return add_node(p, K::Error, u32(from.token));
+}
+
+static NodeIndex parse_expression(Parser* p, i32 min_precedence = precedence_assign);
+static NodeIndex parse_statement(Parser* p);
+static NodeIndex parse_block(Parser* p);
+
+//// Expressions
+static
+NodeIndex parse_prefix(Parser* p){
+	switch(peek(p)){
+		case T::Identifier: return add_node(p, K::Identifier, advance(p));
+		case T::Integer:    return add_node(p, K::IntegerLiteral, advance(p));
+		case T::Real:       return add_node(p, K::RealLiteral, advance(p));
+		case T::String:     return add_node(p, K::StringLiteral, advance(p));
+		case T::True:
+		case T::False:      return add_node(p, K::BoolLiteral, advance(p));
+
+		case T::ParenOpen: {
+			advance(p);
+			NodeIndex inner = parse_expression(p);
+			expect(p, T::ParenClose);
+			return inner;
+		}
+
+		case T::Minus: case T::LogicNot: case T::Tilde: case T::And: {
+			u32 op = advance(p);
+			NodeIndex operand = parse_expression(p, precedence_prefix);
+			return add_node(p, K::Unary, op, operand);
+		}
+
+		default:
+			fail(p, ErrorType::Parser_ExpectedExpression);
+			return 0;
+	}
+}
+
+static
+NodeIndex parse_postfix(Parser* p, NodeIndex lhs){
+	for(;;){
+		switch(peek(p)){
+			case T::ParenOpen: {
+				u32 token = advance(p);
+				isize mark = p->scratch.len();
+				while(peek(p) != T::ParenClose && peek(p) != T::EndOfFile){
+					push(p, parse_expression(p));
+					if(!accept(p, T::Comma)){ break; }
+				}
+				expect(p, T::ParenClose);
+
+				auto [start, end] = finish_list(p, mark);
+				u32 args = add_extra(p, start);
+				add_extra(p, end);
+				lhs = add_node(p, K::Call, token, lhs, args);
+			} break;
+
+			case T::SquareOpen: {
+				u32 token = advance(p);
+				NodeIndex index = parse_expression(p);
+				expect(p, T::SquareClose);
+				lhs = add_node(p, K::Index, token, lhs, index);
+			} break;
+
+			case T::Dot: {
+				u32 token = advance(p);
+				NodeIndex name = add_node(p, K::Identifier, expect(p, T::Identifier));
+				lhs = add_node(p, K::Member, token, lhs, name);
+			} break;
+
+			case T::Caret:
+				lhs = add_node(p, K::Deref, advance(p), lhs);
+				break;
+
+			default:
+				return lhs;
+		}
+	}
+}
+
+static
+NodeIndex parse_expression(Parser* p, i32 min_precedence){
+	if(!enter(p)){ return 0; }
+	defer(leave(p));
+
+	NodeIndex lhs = parse_postfix(p, parse_prefix(p));
+	for(;;){
+		i32 precedence = infix_precedence(peek(p));
+		if(precedence == precedence_none || precedence < min_precedence){ break; }
+
+		u32 op = advance(p);
+		bool assign = precedence == precedence_assign;
+		NodeIndex rhs = parse_expression(p, assign ? precedence : precedence + 1);
+		lhs = add_node(p, assign ? K::Assign : K::Binary, op, lhs, rhs);
+	}
+	return lhs;
+}
+
+//// Types
+static
+NodeIndex parse_type(Parser* p){
+	if(!enter(p)){ return 0; }
+	defer(leave(p));
+
+	switch(peek(p)){
+		case T::Caret: {
+			u32 token = advance(p);
+			return add_node(p, K::PointerType, token, parse_type(p));
+		}
+
+		case T::SquareOpen: {
+			u32 token = advance(p);
+			if(accept(p, T::SquareClose)){
+				return add_node(p, K::SliceType, token, parse_type(p));
+			}
+			NodeIndex length = parse_expression(p);
+			expect(p, T::SquareClose);
+			return add_node(p, K::ArrayType, token, length, parse_type(p));
+		}
+
+		case T::Identifier: {
+			NodeIndex type = add_node(p, K::Identifier, advance(p));
+			while(peek(p) == T::Dot){
+				u32 token = advance(p);
+				NodeIndex name = add_node(p, K::Identifier, expect(p, T::Identifier));
+				type = add_node(p, K::Member, token, type, name);
+			}
+			return type;
+		}
+
+		default:
+			fail(p, ErrorType::Parser_ExpectedType);
+			return 0;
+	}
+}
+
+//// Declarations
+// let and const, the main token of the node is the name
+static
+NodeIndex parse_variable(Parser* p, NodeKind kind){
+	advance(p);
+	u32 name = expect(p, T::Identifier);
+
+	NodeIndex type = 0;
+	if(accept(p, T::Colon)){
+		type = parse_type(p);
+	}
+
+	NodeIndex value = 0;
+	if(kind == K::ConstDecl){
+		expect(p, T::Assign);
+		value = parse_expression(p);
+	}
+	else if(accept(p, T::Assign)){
+		value = parse_expression(p);
+	}
+
+	expect(p, T::Semicolon);
+	return add_node(p, kind, name, type, value);
+}
+
+static
+NodeIndex parse_fn(Parser* p){
+	advance(p);
+	u32 name = expect(p, T::Identifier);
+
+	expect(p, T::ParenOpen);
+	isize mark = p->scratch.len();
+	while(peek(p) != T::ParenClose && peek(p) != T::EndOfFile){
+		u32 param = expect(p, T::Identifier);
+		expect(p, T::Colon);
+		push(p, add_node(p, K::Param, param, parse_type(p)));
+		if(!accept(p, T::Comma)){ break; }
+	}
+	expect(p, T::ParenClose);
+
+	NodeIndex return_type = 0;
+	if(accept(p, T::ArrowRight)){
+		return_type = parse_type(p);
+	}
+
+	auto [start, end] = finish_list(p, mark);
+	u32 proto = add_extra(p, start);
+	add_extra(p, end);
+	add_extra(p, return_type);
+
+	NodeIndex body = parse_block(p);
+	return add_node(p, K::FnDecl, name, proto, body);
+}
+
+static
+NodeIndex parse_struct(Parser* p){
+	advance(p);
+	u32 name = expect(p, T::Identifier);
+
+	expect(p, T::CurlyOpen);
+	isize mark = p->scratch.len();
+	while(peek(p) != T::CurlyClose && peek(p) != T::EndOfFile){
+		u32 field = expect(p, T::Identifier);
+		expect(p, T::Colon);
+		push(p, add_node(p, K::Field, field, parse_type(p)));
+		if(!accept(p, T::Comma)){ accept(p, T::Semicolon); }
+	}
+	expect(p, T::CurlyClose);
+
+	auto [start, end] = finish_list(p, mark);
+	return add_node(p, K::StructDecl, name, start, end);
+}
+
+static
+NodeIndex parse_declaration(Parser* p){
+	switch(peek(p)){
+		case T::Fn:     return parse_fn(p);
+		case T::Struct: return parse_struct(p);
+		case T::Const:  return parse_variable(p, K::ConstDecl);
+		case T::Let:    return parse_variable(p, K::LetDecl);
+		default:
+			fail(p, ErrorType::Parser_ExpectedDeclaration);
+			return 0;
+	}
+}
+
+// A declaration, or the Error node recovery leaves in its place, added to the
+// root list. Its main tokens count from the token it starts at.
+static
+void parse_top_level(Parser* p){
+	p->token_base = u32(p->current);
+	Checkpoint from = checkpoint(p);
+	NodeIndex declaration = parse_declaration(p);
+	if(p->failed){
+		declaration = recover(p, from, true);
+	}
+
+	isize len = p->roots.len();
+	p->roots.append(Declaration{ .node = declaration, .first_token = p->token_base });
+	if(p->roots.len() == len){ fail(p, ErrorType::Parser_OutOfMemory); }
+}
+
+//// Statements
+static
+NodeIndex parse_block(Parser* p){
+	u32 token = expect(p, T::CurlyOpen);
+
+	isize mark = p->scratch.len();
+	while(peek(p) != T::CurlyClose && peek(p) != T::EndOfFile){
+		if(accept(p, T::Semicolon)){ continue; }
+
+		Checkpoint from = checkpoint(p);
+		NodeIndex statement = parse_statement(p);
+		if(p->failed){
+			statement = recover(p, from, false);
+		}
+		push(p, statement);
+	}
+	expect(p, T::CurlyClose);
+
+	auto [start, end] = finish_list(p, mark);
+	return add_node(p, K::Block, token, start, end);
+}
+
+static
+NodeIndex parse_if(Parser* p){
+	if(!enter(p)){ return 0; }
+	defer(leave(p));
+
+	u32 token = advance(p);
+	NodeIndex condition = parse_expression(p);
+	NodeIndex then = parse_block(p);
+
+	NodeIndex otherwise = 0;
+	if(accept(p, T::Else)){
+		otherwise = peek(p) == T::If ? parse_if(p) : parse_block(p);
+	}
+
+	u32 branches = add_extra(p, then);
+	add_extra(p, otherwise);
+	return add_node(p, K::If, token, condition, branches);
+}
+
+static
+NodeIndex parse_match(Parser* p){
+	u32 token = advance(p);
+	NodeIndex subject = parse_expression(p);
+
+	expect(p, T::CurlyOpen);
+	isize mark = p->scratch.len();
+	while(peek(p) != T::CurlyClose && peek(p) != T::EndOfFile){
+		NodeIndex pattern = parse_expression(p);
+		u32 arrow = expect(p, T::ArrowRight);
+		NodeIndex body = peek(p) == T::CurlyOpen ? parse_block(p) : parse_expression(p);
+		push(p, add_node(p, K::MatchArm, arrow, pattern, body));
+		accept(p, T::Comma);
+	}
+	expect(p, T::CurlyClose);
+
+	auto [start, end] = finish_list(p, mark);
+	u32 arms = add_extra(p, start);
+	add_extra(p, end);
+	return add_node(p, K::Match, token, subject, arms);
+}
+
+static
+NodeIndex parse_statement(Parser* p){
+	if(!enter(p)){ return 0; }
+	defer(leave(p));
+
+	switch(peek(p)){
+		case T::Let:    return parse_variable(p, K::LetDecl);
+		case T::Const:  return parse_variable(p, K::ConstDecl);
+		case T::Fn:     return parse_fn(p);
+		case T::Struct: return parse_struct(p);
+
+		case T::If:        return parse_if(p);
+		case T::Match:     return parse_match(p);
+		case T::CurlyOpen: return parse_block(p);
+
+		case T::For: {
+			u32 token = advance(p);
+			NodeIndex condition = peek(p) == T::CurlyOpen ? 0 : parse_expression(p);
+			NodeIndex body = parse_block(p);
+			return add_node(p, K::For, token, condition, body);
+		}
+
+		case T::Return: {
+			u32 token = advance(p);
+			NodeIndex value = peek(p) == T::Semicolon ? 0 : parse_expression(p);
+			expect(p, T::Semicolon);
+			return add_node(p, K::Return, token, value);
+		}
+
+		case T::Break:
+		case T::Continue: {
+			NodeKind kind = peek(p) == T::Break ? K::Break : K::Continue;
+			u32 token = advance(p);
+			expect(p, T::Semicolon);
+			return add_node(p, kind, token);
+		}
+
+		default: {
+			NodeIndex expr = parse_expression(p);
+			expect(p, T::Semicolon);
+			return expr;
+		}
+	}
+}
+
+// Buffers are sized for `token_count` tokens of typical code
+static
+void init_parser(Parser* p, TokenStream* tokens, ErrorList* errors, isize token_count){
+	p->tokens  = tokens;
+	p->current = 0;
+	p->token_base = 0;
+	p->depth   = 0;
+	p->failed  = false;
+	p->errors  = errors;
+
+	// Every node but the root has a main token of its own, so this never grows
+	isize node_estimate = token_count + 1;
+	p->kinds       = DynamicArray<NodeKind>::create(heap_allocator(), node_estimate);
+	p->main_tokens = DynamicArray<u32>::create(heap_allocator(), node_estimate);
+	p->data        = DynamicArray<NodeData>::create(heap_allocator(), node_estimate);
+	p->extra       = DynamicArray<u32>::create(heap_allocator(), max(isize(64), token_count / 4));
+	p->scratch     = DynamicArray<u32>::create(heap_allocator(), 256);
+	p->roots       = DynamicArray<Declaration>::create(heap_allocator(), max(isize(64), token_count / 64));
+}
+
+// Exactly sized columns for `count` nodes, `extra_count` extra entries and
+// `root_count` declarations
+static
+bool allocate_ast(Ast* ast, Arena* arena, isize count, isize extra_count, isize root_count){
+	ast->count       = count;
+	ast->extra_count = extra_count;
+	ast->root_count  = root_count;
+	ast->kinds       = arena->make<NodeKind>(count);
+	ast->main_tokens = arena->make<u32>(count);
+	ast->data        = arena->make<NodeData>(count);
+	ast->extra       = arena->make<u32>(extra_count);
+	ast->roots       = arena->make<Declaration>(root_count);
+	return ast->kinds.len() == count && ast->main_tokens.len() == count && ast->data.len() == count
+		&& ast->extra.len() == extra_count && ast->roots.len() == root_count;
+}
+
+// Shift the references of node i, copied into `ast` from a tree where its
+// nodes and extra entries were `node_delta` and `extra_delta` places earlier
+// (the deltas wrap, so they may be negative). The extra entries the node owns
+// are shifted with it, main tokens are left alone.
+static
+void rebase_node(Ast* ast, NodeIndex i, u32 node_delta, u32 extra_delta){
+	auto node = [&](u32 v){ return v ? v + node_delta : 0; };
+	auto list = [&](u32 start, u32 end){
+		for(u32 k = start; k < end; k += 1){
+			ast->extra[k] = node(ast->extra[k]);
+		}
+	};
+
+	NodeData& d = ast->data[i];
+	switch(ast->kinds[i]){
+		case K::Root:
+		case K::Error:
+			break;
+
+		case K::Block: case K::StructDecl:
+			d.lhs += extra_delta;
+			d.rhs += extra_delta;
+			list(d.lhs, d.rhs);
+			break;
+
+		case K::FnDecl:
+			d.lhs += extra_delta;
+			d.rhs  = node(d.rhs);
+			ast->extra[d.lhs]     += extra_delta;
+			ast->extra[d.lhs + 1] += extra_delta;
+			ast->extra[d.lhs + 2]  = node(ast->extra[d.lhs + 2]);
+			list(ast->extra[d.lhs], ast->extra[d.lhs + 1]);
+			break;
+
+		case K::If:
+			d.lhs  = node(d.lhs);
+			d.rhs += extra_delta;
+			ast->extra[d.rhs]     = node(ast->extra[d.rhs]);
+			ast->extra[d.rhs + 1] = node(ast->extra[d.rhs + 1]);
+			break;
+
+		case K::Call: case K::Match:
+			d.lhs  = node(d.lhs);
+			d.rhs += extra_delta;
+			ast->extra[d.rhs]     += extra_delta;
+			ast->extra[d.rhs + 1] += extra_delta;
+			list(ast->extra[d.rhs], ast->extra[d.rhs + 1]);
+			break;
+
+		default:
+			d.lhs = node(d.lhs);
+			d.rhs = node(d.rhs);
+			break;
+	}
+}
+}
+
+Result<Ast, Error> parse(Arena* arena, TokenStream* tokens, ErrorList* errors){
+	using namespace parsing;
+	ensure(tokens->count > 0 && tokens->type(tokens->count - 1) == T::EndOfFile, "Token stream must end with EndOfFile");
+
+	Parser p;
+	init_parser(&p, tokens, errors, tokens->count);
+
+	skip_trivia(&p);
+	add_node(&p, K::Root, 0);
+
+	while(peek(&p) != T::EndOfFile){
+		if(accept(&p, T::Semicolon)){ continue; }
+		parse_top_level(&p);
+	}
+	if(p.failed){
+		return p.error;
+	}
+
+	isize count = p.kinds.len();
+	Ast ast;
+	ast.tokens = tokens;
+	if(!allocate_ast(&ast, arena, count, p.extra.len(), p.roots.len())){
+		Error e;
+		e.type = ErrorType::Parser_OutOfMemory;
+		return e;
+	}
+
+	mem_copy_no_overlap(ast.kinds.data(), p.kinds.data(), count * sizeof(NodeKind));
+	mem_copy_no_overlap(ast.main_tokens.data(), p.main_tokens.data(), count * sizeof(u32));
+	mem_copy_no_overlap(ast.data.data(), p.data.data(), count * sizeof(NodeData));
+	mem_copy_no_overlap(ast.extra.data(), p.extra.data(), p.extra.len() * sizeof(u32));
+	mem_copy_no_overlap(ast.roots.data(), p.roots.data(), p.roots.len() * sizeof(Declaration));
+	return ast;
+}
+
+//// Parallel parser
+namespace parallel_parsing {
+using namespace parsing;
+
+constexpr isize max_threads = 64;
+
+// Below this many tokens per worker spawning threads costs more than it saves
+constexpr isize min_chunk_tokens = 64 * 1024;
+
+// The top-level declarations starting in tokens [start, end), parsed into a
+// pool of their own. Node 0 of a pool is a placeholder, so 0 still means
+// none inside it.
+struct Chunk {
+	isize  start = 0;
+	isize  end = 0;
+	bool   ok = false; /* Parsed without errors and stopped exactly at `end` */
+	Parser parser;
+
+	// Where the pool goes in the merged tree
+	isize node_base = 0;
+	isize extra_base = 0;
+	isize declaration_base = 0;
+};
+
+// Token indices of the declaration keywords outside of any braces. Only a
+// guess at where declarations start, the chunk parsers check it.
+static
+DynamicArray<u32> find_declarations(TokenStream const* tokens){
+	auto starts = DynamicArray<u32>::create(heap_allocator(), 256);
+	i32 depth = 0;
+
+	for(isize i = 0; i < tokens->count; i += 1){
+		switch(tokens->type(i)){
+			case T::CurlyOpen:  depth += 1; break;
+			case T::CurlyClose: depth -= 1; break;
+
+			case T::Fn: case T::Struct: case T::Const: case T::Let:
+				if(depth == 0){ starts.append(u32(i)); }
+				break;
+
+			default: break;
+		}
+	}
+	return starts;
+}
+
+static
+void parse_chunk(Chunk* chunk, TokenStream* tokens){
+	Parser* p = &chunk->parser;
+	init_parser(p, tokens, nullptr, chunk->end - chunk->start);
+	p->current = chunk->start;
+
+	skip_trivia(p);
+	add_node(p, K::Root, 0);
+
+	while(p->current < chunk->end && peek(p) != T::EndOfFile){
+		if(accept(p, T::Semicolon)){ continue; }
+		parse_top_level(p);
+	}
+	chunk->ok = !p->failed && p->current == chunk->end;
+}
+
+// Copy the pool of `chunk` and its part of the root list to their places in
+// `ast`
+static
+void merge_chunk(Chunk* chunk, Ast* ast){
+	Parser* p = &chunk->parser;
+	isize count = p->kinds.len() - 1;
+	isize base  = chunk->node_base;
+
+	mem_copy_no_overlap(ast->kinds.data() + base, p->kinds.data() + 1, count * sizeof(NodeKind));
+	mem_copy_no_overlap(ast->main_tokens.data() + base, p->main_tokens.data() + 1, count * sizeof(u32));
+	mem_copy_no_overlap(ast->data.data() + base, p->data.data() + 1, count * sizeof(NodeData));
+	mem_copy_no_overlap(ast->extra.data() + chunk->extra_base, p->extra.data(), p->extra.len() * sizeof(u32));
+
+	u32 node_delta  = u32(base - 1);
+	u32 extra_delta = u32(chunk->extra_base);
+	for(isize i = base; i < base + count; i += 1){
+		rebase_node(ast, NodeIndex(i), node_delta, extra_delta);
+	}
+
+	for(isize k = 0; k < p->roots.len(); k += 1){
+		Declaration decl = p->roots[k];
+		ast->roots[chunk->declaration_base + k] = Declaration{ .node = decl.node + node_delta, .first_token = decl.first_token };
+	}
+}
+}
+
+Result<Ast, Error> parse_parallel(Arena* arena, TokenStream* tokens, isize thread_count, ErrorList* errors){
+	using namespace parallel_parsing;
+	ensure(tokens->count > 0 && tokens->type(tokens->count - 1) == T::EndOfFile, "Token stream must end with EndOfFile");
+
+	if(thread_count <= 0){
+		thread_count = hardware_thread_count();
+	}
+	thread_count = clamp(isize(1), thread_count, min(max_threads, tokens->count / min_chunk_tokens));
+	if(thread_count <= 1){
+		return parse(arena, tokens, errors);
+	}
+
+	// Cut at the first declaration after each even share of the tokens
+	auto starts = find_declarations(tokens);
+	Chunk chunks[max_threads];
+	isize chunk_count = 0;
+	isize prev = 0;
+	isize k = 0;
+
+	for(isize i = 1; i < thread_count; i += 1){
+		isize target = tokens->count * i / thread_count;
+		while(k < starts.len() && (isize(starts[k]) < target || isize(starts[k]) <= prev)){
+			k += 1;
+		}
+		if(k >= starts.len()){ break; }
+
+		chunks[chunk_count].start = prev;
+		chunks[chunk_count].end   = starts[k];
+		chunk_count += 1;
+		prev = starts[k];
+	}
+	chunks[chunk_count].start = prev;
+	chunks[chunk_count].end   = tokens->count - 1;
+	chunk_count += 1;
+
+	if(chunk_count <= 1){
+		return parse(arena, tokens, errors);
+	}
+
+	Thread workers[max_threads];
+	for(isize i = 1; i < chunk_count; i += 1){
+		workers[i] = Thread(parse_chunk, &chunks[i], tokens);
+	}
+	parse_chunk(&chunks[0], tokens);
+	for(isize i = 1; i < chunk_count; i += 1){
+		workers[i].join();
+	}
+
+	// A wrong guess or a syntax error: parse sequentially, which reports
+	// errors exactly like parse() because it is parse()
+	for(isize i = 0; i < chunk_count; i += 1){
+		if(!chunks[i].ok){
+			return parse(arena, tokens, errors);
+		}
+	}
+
+	// Pools go one after another in source order, so the merged tree is the
+	// same as the one parse() builds
+	isize node_count = 1, extra_count = 0, declaration_count = 0;
+	for(isize i = 0; i < chunk_count; i += 1){
+		Parser* p = &chunks[i].parser;
+		chunks[i].node_base        = node_count;
+		chunks[i].extra_base       = extra_count;
+		chunks[i].declaration_base = declaration_count;
+		node_count        += p->kinds.len() - 1;
+		extra_count       += p->extra.len();
+		declaration_count += p->roots.len();
+	}
+
+	Ast ast;
+	ast.tokens = tokens;
+	if(!allocate_ast(&ast, arena, node_count, extra_count, declaration_count)){
+		Error e;
+		e.type = ErrorType::Parser_OutOfMemory;
+		return e;
+	}
+
+	ast.kinds[0]       = K::Root;
+	ast.main_tokens[0] = 0;
+	ast.data[0]        = NodeData{ .lhs = 0, .rhs = 0 };
+
+	for(isize i = 1; i < chunk_count; i += 1){
+		workers[i] = Thread(merge_chunk, &chunks[i], &ast);
+	}
+	merge_chunk(&chunks[0], &ast);
+	for(isize i = 1; i < chunk_count; i += 1){
+		workers[i].join();
+	}
+	return ast;
+}
+
+//// Incremental reparsing
+namespace incremental_parsing {
+using namespace parsing;
+
+// Make room for `needed` entries in `column`, keeping the first `used`. A
+// column that is too small moves to one with an eighth more room than needed,
+// so appending to it stays amortized constant.
+template<typename T>
+static
+bool reserve(Slice<T>* column, Arena* arena, isize used, isize needed){
+	if(column->len() >= needed){ return true; }
+
+	isize capacity = needed + needed / 8;
+	auto grown = arena->make<T>(capacity);
+	if(grown.len() != capacity){ return false; }
+	mem_copy_no_overlap(grown.data(), column->data(), used * sizeof(T));
+	*column = grown;
+	return true;
+}
+}
+
+Result<Reparsed, Error> reparse(Arena* arena, Ast* ast, Relexed const* change, ErrorList* errors){
+	using namespace incremental_parsing;
+	TokenStream* tokens = ast->tokens;
+	ensure(tokens->count > 0 && tokens->type(tokens->count - 1) == T::EndOfFile, "Token stream must end with EndOfFile");
+
+	auto decls  = ast->declarations();
+	isize count = decls.len();
+	isize delta = change->new_end - change->old_end;
+
+	// A declaration is affected when one of the edited tokens falls between
+	// its start and the start of the next one, inclusive: recovery from an
+	// error stops at the next declaration keyword.
+	auto next_start = [&](isize k){
+		return k + 1 < count ? isize(decls[k + 1].first_token) : tokens->count;
+	};
+
+	isize lo = 0, hi = count;
+	while(lo < hi){
+		isize mid = lo + (hi - lo) / 2;
+		if(next_start(mid) < change->first){ lo = mid + 1; }
+		else { hi = mid; }
+	}
+	isize first = lo;
+
+	hi = count;
+	while(lo < hi){
+		isize mid = lo + (hi - lo) / 2;
+		if(isize(decls[mid].first_token) < change->old_end){ lo = mid + 1; }
+		else { hi = mid; }
+	}
+	isize resume = lo;
+
+	// Parse from the first affected declaration until the parser is at the
+	// start of an old declaration again. The old declarations it ran into
+	// are dropped.
+	isize region_start = first == 0 ? 0 : decls[first].first_token;
+	isize region_end   = resume < count ? decls[resume].first_token + delta : tokens->count;
+
+	Parser p;
+	init_parser(&p, tokens, errors, region_end - region_start);
+	p.current = region_start;
+
+	skip_trivia(&p);
+	add_node(&p, K::Root, 0);
+
+	for(;;){
+		while(resume < count && isize(decls[resume].first_token) + delta < p.current){
+			resume += 1;
+		}
+		if(resume < count && isize(decls[resume].first_token) + delta == p.current){ break; }
+		if(peek(&p) == T::EndOfFile){ break; }
+		if(accept(&p, T::Semicolon)){ continue; }
+		parse_top_level(&p);
+	}
+	if(p.failed){
+		return p.error;
+	}
+
+	isize region_nodes = p.kinds.len() - 1;
+	isize new_count    = ast->count + region_nodes;
+	isize new_extra    = ast->extra_count + p.extra.len();
+	isize new_end      = first + p.roots.len();
+	isize root_count   = new_end + (count - resume);
+
+	bool grown = reserve(&ast->kinds, arena, ast->count, new_count)
+		&& reserve(&ast->main_tokens, arena, ast->count, new_count)
+		&& reserve(&ast->data, arena, ast->count, new_count)
+		&& reserve(&ast->extra, arena, ast->extra_count, new_extra)
+		&& reserve(&ast->roots, arena, ast->root_count, root_count);
+	if(!grown){
+		Error e;
+		e.type = ErrorType::Parser_OutOfMemory;
+		return e;
+	}
+
+	// The reparsed nodes go after all the old ones
+	u32 node_delta  = u32(ast->count - 1);
+	u32 extra_delta = u32(ast->extra_count);
+	mem_copy_no_overlap(ast->kinds.data() + ast->count, p.kinds.data() + 1, region_nodes * sizeof(NodeKind));
+	mem_copy_no_overlap(ast->main_tokens.data() + ast->count, p.main_tokens.data() + 1, region_nodes * sizeof(u32));
+	mem_copy_no_overlap(ast->data.data() + ast->count, p.data.data() + 1, region_nodes * sizeof(NodeData));
+	mem_copy_no_overlap(ast->extra.data() + ast->extra_count, p.extra.data(), p.extra.len() * sizeof(u32));
+	for(isize i = ast->count; i < new_count; i += 1){
+		rebase_node(ast, NodeIndex(i), node_delta, extra_delta);
+	}
+
+	// Declarations after the edit keep their nodes, only where their tokens
+	// start moves
+	auto roots = ast->roots;
+	mem_copy(roots.data() + new_end, roots.data() + resume, (count - resume) * sizeof(Declaration));
+	for(isize k = new_end; k < root_count; k += 1){
+		roots[k].first_token += u32(delta);
+	}
+	for(isize k = 0; k < p.roots.len(); k += 1){
+		Declaration decl = p.roots[k];
+		roots[first + k] = Declaration{ .node = decl.node + node_delta, .first_token = decl.first_token };
+	}
+
+	ast->count       = new_count;
+	ast->extra_count = new_extra;
+	ast->root_count  = root_count;
+
+	Reparsed result;
+	result.first   = first;
+	result.old_end = resume;
+	result.new_end = new_end;
+	return result;
+}
+
+} /* Namespace */
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "core/core.hpp"
+#include "core/memory.hpp"
+
+#include "lexer.hpp"
+
+// The syntax tree is stored as parallel arrays indexed by node, like the
+// TokenStream: a kind byte, the main token and a pair of u32 slots whose
+// meaning depends on the kind, 13 bytes per node with no padding. Nodes with
+// more than two children keep them as a range of `extra`. Node 0 is the root,
+// every other node comes after its children. Index 0 doubles as "none" in
+// child slots, since the root is never a child.
+//
+// The top-level declarations are kept in a root list of their own, each with
+// the token it starts at. Main tokens count from the start of the declaration
+// the node belongs to, so a declaration that moves to other token indices
+// after an edit only has its root list entry updated.
+
+namespace kielo {
+using namespace core;
+
+using NodeIndex = u32;
+
+enum class NodeKind : u8 {
+	Root,          /* Declarations are in the root list, lhs and rhs are unused */
+	Error,         /* Declaration or statement that failed to parse, main token is its first token */
+
+	// Declarations, the main token is the name
+	FnDecl,        /* lhs: extra {params start, params end, return type or 0}, rhs: body */
+	Param,         /* lhs: type */
+	StructDecl,    /* Fields in extra[lhs, rhs) */
+	Field,         /* lhs: type */
+	ConstDecl,     /* lhs: type or 0, rhs: value */
+	LetDecl,       /* lhs: type or 0, rhs: value or 0 */
+
+	// Statements, the main token is the keyword
+	Block,         /* Statements in extra[lhs, rhs), main token is { */
+	Return,        /* lhs: value or 0 */
+	If,            /* lhs: condition, rhs: extra {then, else or 0} */
+	For,           /* lhs: condition or 0, rhs: body */
+	Match,         /* lhs: subject, rhs: extra {arms start, arms end} */
+	MatchArm,      /* lhs: pattern, rhs: body, main token is -> */
+	Break,
+	Continue,
+
+	// Expressions, the main token is the operator
+	Assign,        /* lhs: target, rhs: value */
+	Binary,        /* lhs, rhs: operands */
+	Unary,         /* lhs: operand */
+	Call,          /* lhs: callee, rhs: extra {args start, args end}, main token is ( */
+	Index,         /* lhs: object, rhs: index, main token is [ */
+	Member,        /* lhs: object, rhs: Identifier */
+	Deref,         /* lhs: pointer, main token is the postfix ^ */
+	Identifier,
+	IntegerLiteral,
+	RealLiteral,
+	StringLiteral,
+	BoolLiteral,
+
+	// Types
+	PointerType,   /* lhs: element */
+	SliceType,     /* lhs: element */
+	ArrayType,     /* lhs: length, rhs: element */
+};
+
+struct NodeData {
+	u32 lhs;
+	u32 rhs;
+};
+
+static_assert(sizeof(NodeKind) + sizeof(u32) + sizeof(NodeData) == 13, "Node columns should take 13 bytes");
+
+// Entry of the root list
+struct Declaration {
+	NodeIndex node;
+	u32       first_token; /* Main tokens of its nodes count from here */
+};
+
+// All columns of one node
+struct Node {
+	NodeKind kind;
+	u32      token;
+	u32      lhs;
+	u32      rhs;
+};
+
+// Columns may have room past their counts, which reparse() appends to
+struct Ast {
+	TokenStream*       tokens;
+	Slice<NodeKind>    kinds;
+	Slice<u32>         main_tokens; /* Relative to the first token of the declaration */
+	Slice<NodeData>    data;
+	Slice<u32>         extra;
+	Slice<Declaration> roots;
+	isize              count;
+	isize              extra_count;
+	isize              root_count;
+
+	NodeKind kind(NodeIndex i) const;
+
+	// Main token of node i, which is part of `decl`. The root is part of an
+	// empty Declaration.
+	u32 main_token(Declaration decl, NodeIndex i) const;
+
+	NodeData children(NodeIndex i) const;
+
+	Node node(Declaration decl, NodeIndex i) const;
+
+	// Node indices stored in extra[start, end)
+	Slice<u32> list(u32 start, u32 end) const;
+
+	// The root list, in source order
+	Slice<Declaration> declarations() const;
+
+	Ast() : tokens{nullptr}, kinds{}, main_tokens{}, data{}, extra{}, roots{}, count{0}, extra_count{0}, root_count{0} {}
+};
+
+// Parse a whole token stream, stops at the first error. Whitespace and
+// comment tokens are skipped, so streams lexed with either TriviaMode work.
+// Node columns are built in growable buffers and copied to `arena` once,
+// exactly sized. When `errors` is given parsing recovers instead, every error
+// is appended to the list and the declaration or statement it was found in
+// becomes an Error node; only running out of memory fails the parse.
+Result<Ast, Error> parse(Arena* arena, TokenStream* tokens, ErrorList* errors = nullptr);
+
+// Same as parse, but a brace matching pre-pass splits the stream between
+// top-level declarations and the pieces are parsed concurrently by up to
+// `thread_count` workers (0 means one per hardware thread), each into a node
+// pool of its own. The pools are merged with their indices rebased into the
+// same tree parse() builds. On any error the stream is parsed again with
+// parse(), so errors are reported the same way.
+Result<Ast, Error> parse_parallel(Arena* arena, TokenStream* tokens, isize thread_count = 0, ErrorList* errors = nullptr);
+
+// Declarations [first, old_end) of the root list before the edit became
+// declarations [first, new_end), the others were reused
+struct Reparsed {
+	isize first;
+	isize old_end;
+	isize new_end;
+};
+
+// Update `ast` in place after relex() edited its token stream, `change` is
+// what relex() returned. Edits are reparsed one at a time, in order.
+// Only the top-level declarations the edited tokens touch are parsed again,
+// from the start of the first one until the parser lands on the start of an
+// old declaration past the edit. With `errors` the reparsed declarations
+// recover like parse() does, errors in reused declarations are not reported
+// again. On failure the nodes are left as they were, but the stream already
+// has the edit, so the tree has to be parsed again.
+//
+// The reparsed nodes are appended to the columns. Reused declarations keep
+// their nodes where they are, the ones after the edit only get their first
+// token moved in the root list, so an edit costs its parsing plus a move of
+// the root list. Nodes of the replaced declarations stay in the columns
+// unused until the program is parsed again. A column without room for the new
+// nodes is moved to a bigger one in `arena`, which happens on the first edit
+// of a tree from parse() and then only every so many nodes. Apart from where
+// nodes are stored the result is the tree parse() would build.
+Result<Reparsed, Error> reparse(Arena* arena, Ast* ast, Relexed const* change, ErrorList* errors = nullptr);
+
+constexpr static inline
+String node_kind_name(NodeKind k, caller_location(loc)){
+	using K = NodeKind;
+
+	switch(k){
+	case K::Root: return "Root";
+	case K::Error: return "Error";
+
+	case K::FnDecl: return "FnDecl";
+	case K::Param: return "Param";
+	case K::StructDecl: return "StructDecl";
+	case K::Field: return "Field";
+	case K::ConstDecl: return "ConstDecl";
+	case K::LetDecl: return "LetDecl";
+
+	case K::Block: return "Block";
+	case K::Return: return "Return";
+	case K::If: return "If";
+	case K::For: return "For";
+	case K::Match: return "Match";
+	case K::MatchArm: return "MatchArm";
+	case K::Break: return "Break";
+	case K::Continue: return "Continue";
+
+	case K::Assign: return "Assign";
+	case K::Binary: return "Binary";
+	case K::Unary: return "Unary";
+	case K::Call: return "Call";
+	case K::Index: return "Index";
+	case K::Member: return "Member";
+	case K::Deref: return "Deref";
+	case K::Identifier: return "Identifier";
+	case K::IntegerLiteral: return "IntegerLiteral";
+	case K::RealLiteral: return "RealLiteral";
+	case K::StringLiteral: return "StringLiteral";
+	case K::BoolLiteral: return "BoolLiteral";
+
+	case K::PointerType: return "PointerType";
+	case K::SliceType: return "SliceType";
+	case K::ArrayType: return "ArrayType";
+	}
+
+	panic("Unknown node kind", loc);
+}
+}
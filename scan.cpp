@@ -0,0 +1,203 @@
+#include "scan.hpp"
+
+#if !defined(KIELO_DISABLE_SIMD)
+	#if defined(__AVX2__)
+		#define KIELO_SCAN_AVX2 1
+	#elif defined(__SSE2__) || defined(_M_X64)
+		#define KIELO_SCAN_SSE2 1
+	#endif
+#endif
+
+#if defined(KIELO_SCAN_AVX2) || defined(KIELO_SCAN_SSE2)
+#include <immintrin.h>
+#endif
+
+namespace kielo {
+
+static forceinline
+i32 scan_trailing_zeros(u32 x){
+	#if defined(COMPILER_MSVC)
+	unsigned long idx = 0;
+	_BitScanForward(&idx, x);
+	return i32(idx);
+	#else
+	return __builtin_ctz(x);
+	#endif
+}
+
+static forceinline
+i32 scan_popcount(u32 x){
+	#if defined(COMPILER_MSVC)
+	return i32(__popcnt(x));
+	#else
+	return __builtin_popcount(x);
+	#endif
+}
+
+static forceinline
+bool scan_is_identifier_byte(byte c){
+	byte lower = c | 0x20;
+	return (lower >= 'a' && lower <= 'z') || (c >= '0' && c <= '9') || (c == '_');
+}
+
+static forceinline
+bool scan_is_whitespace_byte(byte c){
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+//// Vector primitives
+// NOTE: Comparisons are signed, so any byte >= 0x80 falls below every ASCII
+// range and is never part of a run.
+#if defined(KIELO_SCAN_AVX2)
+using Vec = __m256i;
+constexpr isize vec_width = 32;
+constexpr u32 vec_full_mask = 0xffff'ffff;
+
+static forceinline Vec vec_load(byte const* p){ return _mm256_loadu_si256((Vec const*)p); }
+static forceinline Vec vec_splat(byte b){ return _mm256_set1_epi8(char(b)); }
+static forceinline Vec vec_eq(Vec a, Vec b){ return _mm256_cmpeq_epi8(a, b); }
+static forceinline Vec vec_gt(Vec a, Vec b){ return _mm256_cmpgt_epi8(a, b); }
+static forceinline Vec vec_and(Vec a, Vec b){ return _mm256_and_si256(a, b); }
+static forceinline Vec vec_or(Vec a, Vec b){ return _mm256_or_si256(a, b); }
+static forceinline u32 vec_mask(Vec v){ return u32(_mm256_movemask_epi8(v)); }
+
+#elif defined(KIELO_SCAN_SSE2)
+using Vec = __m128i;
+constexpr isize vec_width = 16;
+constexpr u32 vec_full_mask = 0xffff;
+
+static forceinline Vec vec_load(byte const* p){ return _mm_loadu_si128((Vec const*)p); }
+static forceinline Vec vec_splat(byte b){ return _mm_set1_epi8(char(b)); }
+static forceinline Vec vec_eq(Vec a, Vec b){ return _mm_cmpeq_epi8(a, b); }
+static forceinline Vec vec_gt(Vec a, Vec b){ return _mm_cmpgt_epi8(a, b); }
+static forceinline Vec vec_and(Vec a, Vec b){ return _mm_and_si128(a, b); }
+static forceinline Vec vec_or(Vec a, Vec b){ return _mm_or_si128(a, b); }
+static forceinline u32 vec_mask(Vec v){ return u32(_mm_movemask_epi8(v)); }
+#endif
+
+#if defined(KIELO_SCAN_AVX2) || defined(KIELO_SCAN_SSE2)
+static forceinline
+Vec vec_in_range(Vec v, byte lo, byte hi){
+	return vec_and(vec_gt(v, vec_splat(lo - 1)), vec_gt(vec_splat(hi + 1), v));
+}
+
+static forceinline
+u32 identifier_stop_mask(Vec v){
+	Vec alpha = vec_in_range(vec_or(v, vec_splat(0x20)), 'a', 'z');
+	Vec digit = vec_in_range(v, '0', '9');
+	Vec under = vec_eq(v, vec_splat('_'));
+	return ~vec_mask(vec_or(vec_or(alpha, digit), under)) & vec_full_mask;
+}
+
+static forceinline
+u32 whitespace_stop_mask(Vec v){
+	Vec space = vec_or(vec_eq(v, vec_splat(' ')), vec_eq(v, vec_splat('\t')));
+	Vec line  = vec_or(vec_eq(v, vec_splat('\n')), vec_eq(v, vec_splat('\r')));
+	return ~vec_mask(vec_or(space, line)) & vec_full_mask;
+}
+
+static forceinline
+u32 line_end_stop_mask(Vec v){
+	return vec_mask(vec_eq(v, vec_splat('\n')));
+}
+
+static forceinline
+u32 string_stop_mask(Vec v){
+	Vec quote = vec_or(vec_eq(v, vec_splat('"')), vec_eq(v, vec_splat('\\')));
+	return vec_mask(vec_or(quote, vec_eq(v, vec_splat('\n'))));
+}
+#endif
+
+// Scans whole vectors until `stop_mask` reports a terminating byte, returns
+// its index or the start of the (shorter than a vector) tail.
+template<typename VecStop>
+static forceinline
+isize scan_vectors([[maybe_unused]] Slice<byte> buf, [[maybe_unused]] VecStop&& stop_mask){
+	isize i = 0;
+	#if defined(KIELO_SCAN_AVX2) || defined(KIELO_SCAN_SSE2)
+	byte const* data = buf.data();
+	for(; i + vec_width <= buf.len(); i += vec_width){
+		u32 m = stop_mask(vec_load(data + i));
+		if(m != 0){
+			return i + scan_trailing_zeros(m);
+		}
+	}
+	#endif
+	return i;
+}
+
+#if defined(KIELO_SCAN_AVX2) || defined(KIELO_SCAN_SSE2)
+	#define SCAN_KERNEL(Fn) Fn
+#else
+	#define SCAN_KERNEL(Fn) nullptr
+#endif
+
+isize scan_identifier_end(Slice<byte> buf){
+	isize i = scan_vectors(buf, SCAN_KERNEL(identifier_stop_mask));
+	byte const* data = buf.data();
+	while(i < buf.len() && scan_is_identifier_byte(data[i])){ i += 1; }
+	return i;
+}
+
+isize scan_whitespace_end(Slice<byte> buf){
+	isize i = scan_vectors(buf, SCAN_KERNEL(whitespace_stop_mask));
+	byte const* data = buf.data();
+	while(i < buf.len() && scan_is_whitespace_byte(data[i])){ i += 1; }
+	return i;
+}
+
+isize scan_line_end(Slice<byte> buf){
+	isize i = scan_vectors(buf, SCAN_KERNEL(line_end_stop_mask));
+	byte const* data = buf.data();
+	while(i < buf.len() && data[i] != '\n'){ i += 1; }
+	return i;
+}
+
+isize scan_string_end(Slice<byte> buf){
+	isize i = scan_vectors(buf, SCAN_KERNEL(string_stop_mask));
+	byte const* data = buf.data();
+	while(i < buf.len() && data[i] != '"' && data[i] != '\\' && data[i] != '\n'){ i += 1; }
+	return i;
+}
+
+isize count_line_feeds(Slice<byte> buf){
+	isize count = 0;
+	isize i = 0;
+	byte const* data = buf.data();
+
+	#if defined(KIELO_SCAN_AVX2) || defined(KIELO_SCAN_SSE2)
+	for(; i + vec_width <= buf.len(); i += vec_width){
+		count += scan_popcount(line_end_stop_mask(vec_load(data + i)));
+	}
+	#endif
+
+	for(; i < buf.len(); i += 1){
+		count += data[i] == '\n';
+	}
+	return count;
+}
+
+void collect_line_starts(Slice<byte> buf, Slice<u32> out){
+	isize k = 0;
+	isize i = 0;
+	byte const* data = buf.data();
+
+	#if defined(KIELO_SCAN_AVX2) || defined(KIELO_SCAN_SSE2)
+	for(; i + vec_width <= buf.len(); i += vec_width){
+		u32 m = line_end_stop_mask(vec_load(data + i));
+		for(; m != 0; m &= m - 1){
+			out[k++] = u32(i + scan_trailing_zeros(m) + 1);
+		}
+	}
+	#endif
+
+	for(; i < buf.len(); i += 1){
+		if(data[i] == '\n'){
+			out[k++] = u32(i + 1);
+		}
+	}
+}
+
+#undef SCAN_KERNEL
+
+} /* Namespace */
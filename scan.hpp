@@ -0,0 +1,34 @@
+#pragma once
+
+#include "core/core.hpp"
+
+// Bulk byte scanners used by the lexer to skip over runs of characters that
+// cannot end a token. Each one returns the index of the first byte in `buf`
+// that does not belong to the run, or `buf.len()` if the whole buffer does.
+//
+// Kernels are selected at compile time: AVX2 when available, then SSE2, with
+// a scalar fallback. Define KIELO_DISABLE_SIMD to force the scalar version.
+
+namespace kielo {
+using namespace core;
+
+// Run of ASCII identifier characters ([A-Za-z0-9_]), stops at any non-ASCII byte
+isize scan_identifier_end(Slice<byte> buf);
+
+// Run of ' ', '\t', '\r' and '\n'
+isize scan_whitespace_end(Slice<byte> buf);
+
+// Position of the next '\n'
+isize scan_line_end(Slice<byte> buf);
+
+// Number of '\n' bytes in `buf`
+isize count_line_feeds(Slice<byte> buf);
+
+// Writes the offset right after every '\n' in `buf` to `out`, which must have
+// room for count_line_feeds(buf) entries
+void collect_line_starts(Slice<byte> buf, Slice<u32> out);
+
+// Position of the next byte that needs attention inside a string literal:
+// '"', '\\' or '\n'
+isize scan_string_end(Slice<byte> buf);
+}
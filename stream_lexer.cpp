@@ -0,0 +1,217 @@
+#include "core/core.hpp"
+#include "core/stream.hpp"
+
+#include "lexer.hpp"
+#include "scan.hpp"
+
+namespace kielo {
+
+// Bytes that must follow a token in the window before it is trusted: enough
+// for the longest UTF-8 sequence, which also covers one rune of lookahead.
+constexpr isize stream_lookahead = 4;
+
+StreamLexer StreamLexer::create(Stream* input, Slice<byte> window){
+	ensure(window.len() > stream_lookahead, "Stream lexer window is too small");
+	StreamLexer sl;
+	sl.input = input;
+	sl.window = window;
+	sl.lexer.source = window[{0, 0}];
+	return sl;
+}
+
+bool StreamLexer::refill(){
+	isize keep = lexer.current;
+	if(keep == 0 && filled == window.len()){
+		return false; /* Window is full with a single token */
+	}
+
+	mem_copy(window.data(), window.data() + keep, filled - keep);
+	filled -= keep;
+	window_start += keep;
+	lexer.current = 0;
+	lexer.previous = 0;
+
+	while(filled < window.len()){
+		auto res = input->read(window[{filled, window.len()}]);
+		if(!res.ok()){
+			failed = res.unwrap_error() != StreamError::EndOfStream;
+			at_end = true;
+			break;
+		}
+		isize n = res.unwrap();
+		if(n == 0){
+			at_end = true;
+			break;
+		}
+		filled += n;
+	}
+
+	lexer.source = window[{0, filled}];
+	return true;
+}
+
+// End of the window without a UTF-8 sequence that the window end cuts off
+static
+isize complete_end(Slice<byte> window, isize filled){
+	for(isize i = filled - 1; i >= 0 && i >= filled - 3; i -= 1){
+		byte c = window[i];
+		if(c < 0x80){
+			break;
+		}
+		if(!utf8_is_continuation_byte(c)){
+			isize size = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2;
+			return i + size > filled ? i : filled;
+		}
+	}
+	return filled;
+}
+
+void StreamLexer::skip_trivia(){
+	bool comment = false;
+	for(;;){
+		// Everything before current is skipped, so refilling drops it from
+		// the window. Two bytes are enough to tell a comment from a slash.
+		if(!at_end && lexer.current + 2 > filled){
+			refill();
+		}
+
+		isize current = lexer.current;
+		if(current >= filled){
+			break;
+		}
+
+		if(comment){
+			isize end = current + scan_line_end(window[{current, filled}]);
+			comment = end >= filled;
+			lexer.current = min(end + 1, filled);
+			continue;
+		}
+
+		byte c = window[current];
+		if(c == ' ' || c == '\t' || c == '\n' || c == '\r'){
+			lexer.current += scan_whitespace_end(window[{current, filled}]);
+		}
+		else if(c == '/' && current + 1 < filled && window[current + 1] == '/'){
+			lexer.current += 2;
+			comment = true;
+		}
+		else {
+			break;
+		}
+	}
+}
+
+Token StreamLexer::comment_rest(){
+	lexer.trivia_start = lexer.previous = lexer.current;
+
+	isize end = lexer.current + scan_line_end(window[{lexer.current, filled}]);
+	lexer.current = min(end + 1, filled);
+
+	Token token = lexer.make_token(TokenType::LineComment);
+	token.lexeme = String::from_bytes(window[{lexer.previous, end}]);
+	return token;
+}
+
+Result<Token, Error> StreamLexer::next(){
+	if(in_comment && !at_end && lexer.current + stream_lookahead > filled){
+		refill();
+	}
+	in_comment = in_comment && lexer.current < filled;
+
+	if(in_comment){
+		Token token = comment_rest();
+
+		in_comment = !at_end && lexer.current == filled && window[filled - 1] != '\n';
+		if(in_comment){
+			lexer.current = complete_end(window, filled);
+			token.lexeme = String::from_bytes(window[{lexer.previous, lexer.current}]);
+			token.offset = lexer.current;
+		}
+		token.start += window_start;
+		token.offset += window_start;
+		token.trivia_start += window_start;
+		return token;
+	}
+
+	i64 trivia_start = window_start + lexer.current;
+	if(lexer.trivia == TriviaMode::Skip){
+		skip_trivia();
+	}
+
+	for(;;){
+		isize start = lexer.current;
+		auto res = lexer.next();
+
+		// Recovery happens here rather than in the inner lexer so an error
+		// is only recorded once its token is known to be complete
+		bool recovered = !res.ok() && errors != nullptr && lexer.synchronize(res.unwrap_error());
+
+		// The token ends too close to the window end to know it is complete
+		if(!at_end && lexer.current + stream_lookahead > filled){
+			isize end = lexer.current;
+			lexer.current = start;
+			if(refill()){
+				continue;
+			}
+
+			// No room left. A token that stopped before the end of the
+			// window is complete, unless it stopped at a codepoint that the
+			// window end cuts off.
+			lexer.current = end;
+			TokenType type = res.ok() ? res.copy().unwrap().type : TokenType::Unknown;
+			bool trivia_token = type == TokenType::Whitespace || type == TokenType::LineComment;
+			if(!trivia_token && end >= complete_end(window, filled)){
+				lexer.current = start;
+				Error e = lexer.make_error(ErrorType::Lexer_TokenTooLong);
+				e.offset += window_start;
+				return e;
+			}
+
+			// Trivia is split at the window end instead, the rest comes back
+			// as more tokens of the same type
+			if(trivia_token && end >= filled){
+				Token token = res.unwrap();
+				if(type == TokenType::LineComment && window[filled - 1] != '\n'){
+					lexer.current = complete_end(window, filled);
+					token.lexeme = String::from_bytes(window[{token.start, lexer.current}]);
+					token.offset = lexer.current;
+					in_comment = true;
+				}
+				token.start += window_start;
+				token.offset += window_start;
+				token.trivia_start += window_start;
+				return token;
+			}
+		}
+
+		if(failed && start >= filled){
+			Error e = lexer.make_error(ErrorType::Lexer_StreamError);
+			e.offset += window_start;
+			return e;
+		}
+
+		if(!res.ok() && !recovered){
+			Error e = res.unwrap_error();
+			e.offset += window_start;
+			return e;
+		}
+
+		if(recovered){
+			Error e = res.unwrap_error();
+			e.offset += window_start;
+			if(!errors->append(e)){
+				e = lexer.make_error(ErrorType::Lexer_OutOfMemory);
+				e.offset += window_start;
+				return e;
+			}
+		}
+
+		Token token = recovered ? lexer.make_token(TokenType::Unknown) : res.unwrap();
+		token.start += window_start;
+		token.offset += window_start;
+		token.trivia_start = lexer.trivia == TriviaMode::Skip ? trivia_start : token.trivia_start + window_start;
+		return token;
+	}
+}
+
+} /* Namespace */
@@ -0,0 +1,739 @@
+#include "core/core.hpp"
+#include "core/memory.hpp"
+#include "core/dynamic_array.hpp"
+#include "core/thread.hpp"
+
+#include "lexer.hpp"
+#include "scan.hpp"
+
+namespace kielo {
+
+static inline
+bool is_literal(TokenType t){
+	return t == TokenType::Integer || t == TokenType::Real || t == TokenType::String;
+}
+
+// Only types and offsets are kept while building a stream, decoded string
+// literals are given back to the scratch arena right after each token
+static inline
+Result<Token, Error> next_discarding_value(Lexer* lex){
+	auto region = ArenaRegion::create(lex->scratch);
+	auto res = lex->next();
+	region.release();
+	return res;
+}
+
+// Tokens past the gap are stored at the end of the columns, their offsets
+// counted back from the end of the text
+TokenType TokenStream::type(isize i) const {
+	return TokenType(types[i < gap ? i : i + (types.len() - count)]);
+}
+
+u32 TokenStream::offset(isize i) const {
+	if(i < gap){ return offsets[i]; }
+	return u32(text_len - offsets[i + (offsets.len() - count)]);
+}
+
+u32 TokenStream::trivia_start(isize i) const {
+	if(i < gap){ return trivia_starts[i]; }
+	return u32(text_len - trivia_starts[i + (trivia_starts.len() - count)]);
+}
+
+// The text on the side of the gap in the source that `offset` is on, and
+// where it starts. Tokens never straddle the gap.
+static inline
+Slice<byte> text_around(TokenStream const& stream, isize offset, isize* base){
+	if(offset < stream.text_gap){
+		*base = 0;
+		return stream.source[{0, stream.text_gap}];
+	}
+	*base = stream.text_gap;
+	return stream.source[{stream.text_gap + (stream.source.len() - stream.text_len), stream.source.len()}];
+}
+
+Token TokenStream::token(isize i) const {
+	isize start = offset(i);
+	isize base = 0;
+	auto lex = Lexer::create(String::from_bytes(text_around(*this, start, &base)));
+	lex.scratch = arena; /* Decoded string literals live as long as the stream */
+	lex.current = start - base;
+
+	Token token;
+	auto res = lex.next();
+	if(res.ok()){
+		token = res.unwrap();
+	} else {
+		// Unknown tokens from a recovering tokenize_all span the same text again
+		bool recovered = lex.synchronize(res.unwrap_error());
+		ensure(recovered, "Failed to re-lex token");
+		token = lex.make_token(TokenType::Unknown);
+	}
+
+	token.start += base;
+	token.offset += base;
+	token.trivia_start += base;
+	if(trivia_starts.len() > 0){
+		token.trivia_start = trivia_start(i);
+	}
+	return token;
+}
+
+u32 TokenStream::length(isize i) const {
+	ensure_bounds_check(i >= 0 && i < count, "Index to token stream is out of bounds");
+
+	// A token ends where the next one starts, or in Skip mode where the trivia
+	// before the next one does
+	if(i + 1 < count && (trivia == TriviaMode::Tokens || trivia_starts.len() > 0)){
+		isize start = offset(i);
+		if(type(i) == TokenType::LineComment){
+			// The line feed ends the comment but is not part of the lexeme
+			isize base = 0;
+			auto text = text_around(*this, start, &base);
+			return u32(2 + scan_line_end(text[{start - base + 2, text.len()}]));
+		}
+		isize end = trivia == TriviaMode::Tokens ? offset(i + 1) : trivia_start(i + 1);
+		return u32(end - start);
+	}
+
+	auto region = ArenaRegion::create(arena);
+	u32 len = u32(token(i).lexeme.len());
+	region.release();
+	return len;
+}
+
+String TokenStream::lexeme(isize i) const {
+	isize start = offset(i);
+	isize base = 0;
+	auto text = text_around(*this, start, &base);
+	return String::from_bytes(text[{start - base, start - base + length(i)}]);
+}
+
+TokenValue TokenStream::value(isize i){
+	ensure_bounds_check(i >= 0 && i < count, "Index to token stream is out of bounds");
+
+	if(literal_tokens.len() == 0){
+		isize n = 0;
+		for(isize t = 0; t < count; t += 1){
+			n += is_literal(type(t));
+		}
+
+		// One extra entry past the literals so a stream without any is only
+		// scanned once
+		literal_tokens = arena->make<u32>(n + 1);
+		literal_values = Slice((TokenValue*)arena->alloc(max(n, isize(1)) * sizeof(TokenValue), alignof(TokenValue)), n);
+		ensure(literal_tokens.len() == n + 1 && literal_values.data() != nullptr, "Failed to allocate literal table");
+		literal_tokens[n] = u32(count);
+
+		isize k = 0;
+		for(isize t = 0; t < count; t += 1){
+			if(!is_literal(type(t))){ continue; }
+			literal_tokens[k] = u32(t);
+			literal_values[k] = token(t).value;
+			k += 1;
+		}
+	}
+
+	isize lo = 0, hi = literal_values.len();
+	while(lo < hi){
+		isize mid = lo + (hi - lo) / 2;
+		if(isize(literal_tokens[mid]) < i){ lo = mid + 1; }
+		else { hi = mid; }
+	}
+
+	if(lo < literal_values.len() && isize(literal_tokens[lo]) == i){
+		return literal_values[lo];
+	}
+	return TokenValue{ .integer = 0 };
+}
+
+Result<TokenStream, Error> tokenize_all(Arena* arena, String source, TriviaMode trivia, ErrorList* errors){
+	ensure(source.len() < isize(0xffff'ffff), "Source is too big for 32-bit token offsets");
+
+	TokenStream stream;
+	stream.arena    = arena;
+	stream.source   = source.raw_bytes();
+	stream.trivia   = trivia;
+	stream.text_gap = source.len();
+	stream.text_len = source.len();
+	stream.lines    = LineIndex::create(arena, source);
+
+	// Tokens are collected in growable heap arrays first so the arena only
+	// receives the final, exactly sized arrays.
+	isize estimate = max(isize(64), source.len() / 4);
+	auto types   = DynamicArray<u8>::create(heap_allocator(), estimate);
+	auto offsets = DynamicArray<u32>::create(heap_allocator(), estimate);
+	DynamicArray<u32> trivia_starts;
+	if(trivia == TriviaMode::Skip){
+		trivia_starts = DynamicArray<u32>::create(heap_allocator(), estimate);
+	}
+
+	auto lex = Lexer::create(source);
+	lex.scratch = thread_arena();
+	lex.trivia = trivia;
+	lex.errors = errors;
+	lex.validate_utf8();
+	for(;;){
+		if(trivia == TriviaMode::Skip){
+			trivia_starts.append(u32(lex.current));
+			lex.skip_trivia();
+		}
+		isize start = lex.current;
+		auto res = next_discarding_value(&lex);
+		if(!res.ok()){
+			return res.unwrap_error();
+		}
+
+		auto type = res.unwrap().type;
+		types.append(u8(type));
+		offsets.append(u32(start));
+
+		if(type == TokenType::EndOfFile){ break; }
+	}
+
+	stream.count   = types.len();
+	stream.gap     = stream.count;
+	stream.types   = arena->make<u8>(stream.count);
+	stream.offsets = arena->make<u32>(stream.count);
+	if(stream.types.len() != stream.count || stream.offsets.len() != stream.count || offsets.len() != stream.count){
+		return lex.make_error(ErrorType::Lexer_OutOfMemory);
+	}
+	if(trivia == TriviaMode::Skip){
+		stream.trivia_starts = arena->make<u32>(stream.count);
+		if(stream.trivia_starts.len() != stream.count || trivia_starts.len() != stream.count){
+			return lex.make_error(ErrorType::Lexer_OutOfMemory);
+		}
+		mem_copy_no_overlap(stream.trivia_starts.data(), trivia_starts.data(), stream.count * sizeof(u32));
+	}
+
+	mem_copy_no_overlap(stream.types.data(), types.data(), stream.count * sizeof(u8));
+	mem_copy_no_overlap(stream.offsets.data(), offsets.data(), stream.count * sizeof(u32));
+	return stream;
+}
+
+//// Parallel tokenizer
+namespace parallel_lexing {
+constexpr isize max_threads = 64;
+
+// Below this size spawning threads costs more than it saves
+constexpr isize min_chunk_size = 256 * 1024;
+
+struct Chunk {
+	isize start = 0;
+	isize end = 0;
+	isize stop = 0;      /* Offset right after the last recorded token */
+	bool  failed = false; /* Lexing stopped on an error in the trivia or token after `stop` */
+	bool  valid_utf8 = false; /* [start, end) is valid UTF-8 */
+	DynamicArray<u8>  types;
+	DynamicArray<u32> offsets;
+	DynamicArray<u32> trivia_starts; /* TriviaMode::Skip only */
+};
+
+// Lex every token that starts inside [start, end), the last one is allowed to
+// run past `end`.
+static
+void lex_chunk(Chunk* chunk, Slice<byte> source, TriviaMode trivia, Allocator* allocator){
+	isize estimate = max(isize(64), (chunk->end - chunk->start) / 4);
+	chunk->types   = DynamicArray<u8>::create(allocator, estimate);
+	chunk->offsets = DynamicArray<u32>::create(allocator, estimate);
+	if(trivia == TriviaMode::Skip){
+		chunk->trivia_starts = DynamicArray<u32>::create(allocator, estimate);
+	}
+
+	auto lex = Lexer::create(String::from_bytes(source));
+	lex.scratch = thread_arena();
+	lex.current = chunk->start;
+	lex.trivia = trivia;
+
+	// Chunks start after a line feed, so each range can be validated on its
+	// own. Tokens never cross a line feed except for whitespace, which is
+	// ASCII, so unchecked decoding stays inside the validated range.
+	chunk->valid_utf8 = utf8_valid_prefix(source[{chunk->start, chunk->end}]) == chunk->end - chunk->start;
+	lex.utf8_validated = chunk->valid_utf8;
+
+	// The trivia of the first token may start in the previous chunk, the
+	// stitcher knows where and fixes it up
+	isize previous_end = lex.current;
+	while(lex.current < chunk->end){
+		if(trivia == TriviaMode::Skip){
+			lex.skip_trivia();
+			if(lex.current >= chunk->end){ break; }
+		}
+		isize start = lex.current;
+		auto res = next_discarding_value(&lex);
+		if(!res.ok()){
+			chunk->failed = true;
+			break;
+		}
+		chunk->types.append(u8(res.unwrap().type));
+		chunk->offsets.append(u32(start));
+		if(trivia == TriviaMode::Skip){
+			chunk->trivia_starts.append(u32(previous_end));
+		}
+		previous_end = lex.current;
+	}
+
+	if(lex.current >= source.len() && !chunk->failed){
+		chunk->types.append(u8(TokenType::EndOfFile));
+		chunk->offsets.append(u32(source.len()));
+		if(trivia == TriviaMode::Skip){
+			chunk->trivia_starts.append(u32(previous_end));
+		}
+	}
+	chunk->stop = previous_end; /* Trailing trivia is skipped again by the stitcher */
+}
+
+// Position right after the first line feed at or after `target`
+static
+isize line_boundary(Slice<byte> source, isize target){
+	if(target >= source.len()){ return source.len(); }
+	isize nl = target + scan_line_end(source[{target, source.len()}]);
+	return min(nl + 1, source.len());
+}
+}
+
+Result<TokenStream, Error> tokenize_all_parallel(Arena* arena, String source, isize thread_count, TriviaMode trivia){
+	using namespace parallel_lexing;
+	ensure(source.len() < isize(0xffff'ffff), "Source is too big for 32-bit token offsets");
+
+	if(thread_count <= 0){
+		thread_count = hardware_thread_count();
+	}
+	thread_count = clamp(isize(1), thread_count, min(max_threads, source.len() / min_chunk_size));
+	if(thread_count <= 1){
+		return tokenize_all(arena, source, trivia);
+	}
+
+	auto bytes = source.raw_bytes();
+	Allocator* allocator = heap_allocator();
+
+	Chunk chunks[max_threads];
+	Thread workers[max_threads];
+
+	isize prev = 0;
+	for(isize i = 0; i < thread_count; i += 1){
+		chunks[i].start = prev;
+		chunks[i].end   = (i == thread_count - 1) ? bytes.len() : line_boundary(bytes, bytes.len() * (i + 1) / thread_count);
+		prev = chunks[i].end;
+	}
+
+	for(isize i = 1; i < thread_count; i += 1){
+		workers[i] = Thread(lex_chunk, &chunks[i], bytes, trivia, allocator);
+	}
+	lex_chunk(&chunks[0], bytes, trivia, allocator);
+	for(isize i = 1; i < thread_count; i += 1){
+		workers[i].join();
+	}
+
+	// Stitch chunks together. `pos` is where the accepted stream currently
+	// ends, a chunk is only trusted from the first of its tokens that starts
+	// exactly there; anything in between is re-lexed sequentially.
+	isize total = 0;
+	for(isize i = 0; i < thread_count; i += 1){
+		total += chunks[i].types.len();
+	}
+	auto types   = DynamicArray<u8>::create(allocator, total + 16);
+	auto offsets = DynamicArray<u32>::create(allocator, total + 16);
+	DynamicArray<u32> trivia_starts;
+	if(trivia == TriviaMode::Skip){
+		trivia_starts = DynamicArray<u32>::create(allocator, total + 16);
+	}
+
+	auto lex = Lexer::create(source);
+	lex.scratch = thread_arena();
+	lex.trivia = trivia;
+	lex.utf8_validated = true;
+	for(isize i = 0; i < thread_count; i += 1){
+		lex.utf8_validated &= chunks[i].valid_utf8;
+	}
+	isize pos = 0;
+	isize trivia_start = 0;
+	bool done = false;
+
+	for(isize i = 0; i < thread_count && !done; i += 1){
+		Chunk& c = chunks[i];
+		isize k = 0;
+
+		for(;;){
+			// Chunks are matched on where tokens start, not where their trivia does
+			trivia_start = pos;
+			if(trivia == TriviaMode::Skip){
+				lex.current = pos;
+				lex.skip_trivia();
+				pos = lex.current;
+			}
+
+			while(k < c.offsets.len() && isize(c.offsets[k]) < pos){ k += 1; }
+
+			if(k < c.offsets.len() && isize(c.offsets[k]) == pos){
+				if(trivia == TriviaMode::Skip){
+					isize first = trivia_starts.len();
+					trivia_starts.append(Slice(c.trivia_starts.data() + k, c.trivia_starts.len() - k));
+					trivia_starts[first] = u32(trivia_start);
+				}
+				types.append(Slice(c.types.data() + k, c.types.len() - k));
+				offsets.append(Slice(c.offsets.data() + k, c.offsets.len() - k));
+				done = TokenType(types[types.len() - 1]) == TokenType::EndOfFile;
+				pos = c.stop;
+				if(!c.failed){ break; }
+				k = c.offsets.len();
+			}
+
+			if(k >= c.offsets.len() && pos >= max(c.stop, c.end)){ break; }
+
+			// Out of sync, advance one token sequentially
+			lex.current = pos;
+			auto res = next_discarding_value(&lex);
+			if(!res.ok()){
+				return res.unwrap_error();
+			}
+			auto type = res.unwrap().type;
+			types.append(u8(type));
+			offsets.append(u32(pos));
+			if(trivia == TriviaMode::Skip){
+				trivia_starts.append(u32(trivia_start));
+			}
+			pos = lex.current;
+
+			if(type == TokenType::EndOfFile){
+				done = true;
+				break;
+			}
+		}
+	}
+
+	// The last chunk may have stopped right at the end of the source
+	if(!done){
+		types.append(u8(TokenType::EndOfFile));
+		offsets.append(u32(bytes.len()));
+		if(trivia == TriviaMode::Skip){
+			trivia_starts.append(u32(trivia_start));
+		}
+	}
+
+	TokenStream stream;
+	stream.arena    = arena;
+	stream.source   = bytes;
+	stream.trivia   = trivia;
+	stream.text_gap = bytes.len();
+	stream.text_len = bytes.len();
+	stream.lines    = LineIndex::create(arena, source);
+	stream.count    = types.len();
+	stream.gap      = stream.count;
+	stream.types   = arena->make<u8>(stream.count);
+	stream.offsets = arena->make<u32>(stream.count);
+	if(stream.types.len() != stream.count || stream.offsets.len() != stream.count || offsets.len() != stream.count){
+		return lex.make_error(ErrorType::Lexer_OutOfMemory);
+	}
+	if(trivia == TriviaMode::Skip){
+		stream.trivia_starts = arena->make<u32>(stream.count);
+		if(stream.trivia_starts.len() != stream.count || trivia_starts.len() != stream.count){
+			return lex.make_error(ErrorType::Lexer_OutOfMemory);
+		}
+		mem_copy_no_overlap(stream.trivia_starts.data(), trivia_starts.data(), stream.count * sizeof(u32));
+	}
+
+	mem_copy_no_overlap(stream.types.data(), types.data(), stream.count * sizeof(u8));
+	mem_copy_no_overlap(stream.offsets.data(), offsets.data(), stream.count * sizeof(u32));
+	return stream;
+}
+
+//// Incremental re-lexing
+namespace incremental_lexing {
+// How far past its end a token may look to decide where it ends: one rune
+// of lookahead, at most 4 bytes of UTF-8. A token that ends this far before
+// an edit saw none of it.
+constexpr isize lookahead = 4;
+
+// Number of tokens that start at least `lookahead` bytes before `offset`. The
+// last of them is where lexing restarts, the ones before it are unaffected by
+// an edit at `offset`.
+static
+isize tokens_before(TokenStream const& stream, isize offset){
+	isize lo = 0, hi = stream.count;
+	while(lo < hi){
+		isize mid = lo + (hi - lo) / 2;
+		if(isize(stream.offset(mid)) + lookahead <= offset){ lo = mid + 1; }
+		else { hi = mid; }
+	}
+	return lo;
+}
+
+// A gap that has to grow gets an eighth more room than needed, so edits
+// stay amortized constant
+static inline
+isize grown_capacity(isize needed){
+	return needed + max(isize(64), needed / 8);
+}
+
+// Move the gap in the source to `offset`, the bytes in between change sides.
+// Without a gap nothing moves, the source may still be the caller's.
+static
+void move_text_gap(TokenStream* stream, isize offset){
+	isize gap_len = stream->source.len() - stream->text_len;
+	byte* data = stream->source.data();
+	if(offset < stream->text_gap && gap_len > 0){
+		mem_copy(data + offset + gap_len, data + offset, stream->text_gap - offset);
+	}
+	else if(offset > stream->text_gap && gap_len > 0){
+		mem_copy(data + stream->text_gap, data + stream->text_gap + gap_len, offset - stream->text_gap);
+	}
+	stream->text_gap = offset;
+}
+
+// Make the gap in the source longer than `inserted` bytes. A stream without a
+// gap still reads the caller's source, which is never written to.
+static
+bool reserve_text(TokenStream* stream, isize inserted){
+	isize gap_len = stream->source.len() - stream->text_len;
+	if(gap_len > inserted){ return true; }
+
+	auto source = stream->arena->make<byte>(grown_capacity(stream->text_len + inserted));
+	if(source.len() == 0){ return false; }
+
+	isize after = stream->text_len - stream->text_gap;
+	mem_copy_no_overlap(source.data(), stream->source.data(), stream->text_gap);
+	mem_copy_no_overlap(source.data() + source.len() - after, stream->source.data() + stream->source.len() - after, after);
+	stream->source = source;
+	return true;
+}
+
+// Replace `removed` bytes after the gap in the source with `inserted`, which
+// has to fit in the gap
+static
+void replace_text(TokenStream* stream, isize removed, Slice<byte> inserted){
+	stream->text_len -= removed;
+	if(inserted.len() > 0){
+		mem_copy_no_overlap(stream->source.data() + stream->text_gap, inserted.data(), inserted.len());
+	}
+	stream->text_gap += inserted.len();
+	stream->text_len += inserted.len();
+}
+
+// Converts offsets between the two sides of the column gap
+template<typename T>
+static inline
+void move_column_gap(Slice<T> column, isize from, isize to, isize slack, isize text_len, bool counted_back){
+	auto convert = [&](T v){ return counted_back ? T(text_len - v) : v; };
+	if(to < from){
+		for(isize i = from - 1; i >= to; i -= 1){
+			column[i + slack] = convert(column[i]);
+		}
+	}
+	else {
+		for(isize i = from; i < to; i += 1){
+			column[i] = convert(column[i + slack]);
+		}
+	}
+}
+
+// Move the gap in the columns before token `index`, the tokens in between
+// change sides
+static
+void move_token_gap(TokenStream* stream, isize index){
+	isize slack = stream->types.len() - stream->count;
+	if(index != stream->gap){
+		move_column_gap(stream->types, stream->gap, index, slack, 0, false);
+		move_column_gap(stream->offsets, stream->gap, index, slack, stream->text_len, true);
+		if(stream->trivia_starts.len() > 0){
+			move_column_gap(stream->trivia_starts, stream->gap, index, slack, stream->text_len, true);
+		}
+	}
+	stream->gap = index;
+}
+
+// Make room in the columns for `count` tokens
+static
+bool reserve_tokens(TokenStream* stream, isize count){
+	if(stream->types.len() >= count){ return true; }
+
+	isize capacity = grown_capacity(count);
+	bool keep_trivia = stream->trivia_starts.len() > 0;
+	auto types   = stream->arena->make<u8>(capacity);
+	auto offsets = stream->arena->make<u32>(capacity);
+	auto trivia_starts = keep_trivia ? stream->arena->make<u32>(capacity) : Slice<u32>{};
+	if(types.len() != capacity || offsets.len() != capacity || (keep_trivia && trivia_starts.len() != capacity)){
+		return false;
+	}
+
+	// Both sides keep their place relative to their end of the columns
+	isize gap   = stream->gap;
+	isize after = stream->count - gap;
+	isize old_after = stream->types.len() - after;
+	isize new_after = capacity - after;
+	mem_copy_no_overlap(types.data(), stream->types.data(), gap * sizeof(u8));
+	mem_copy_no_overlap(types.data() + new_after, stream->types.data() + old_after, after * sizeof(u8));
+	mem_copy_no_overlap(offsets.data(), stream->offsets.data(), gap * sizeof(u32));
+	mem_copy_no_overlap(offsets.data() + new_after, stream->offsets.data() + old_after, after * sizeof(u32));
+	if(keep_trivia){
+		mem_copy_no_overlap(trivia_starts.data(), stream->trivia_starts.data(), gap * sizeof(u32));
+		mem_copy_no_overlap(trivia_starts.data() + new_after, stream->trivia_starts.data() + old_after, after * sizeof(u32));
+	}
+
+	stream->types = types;
+	stream->offsets = offsets;
+	stream->trivia_starts = trivia_starts;
+	return true;
+}
+}
+
+String TokenStream::text(){
+	incremental_lexing::move_text_gap(this, text_len);
+	return String::from_bytes(source[{0, text_len}]);
+}
+
+Result<Relexed, Error> relex(TokenStream* stream, TextEdit edit, ErrorList* errors){
+	using namespace incremental_lexing;
+	ensure(edit.offset >= 0 && edit.removed >= 0 && edit.offset + edit.removed <= stream->text_len, "Edit is out of bounds");
+	ensure(stream->count > 0, "Token stream is empty");
+
+	isize delta    = edit.inserted.len() - edit.removed;
+	isize new_tail = edit.offset + edit.inserted.len(); /* First byte after the edit */
+	ensure(stream->text_len + delta < isize(0xffff'ffff), "Source is too big for 32-bit token offsets");
+
+	Error out_of_memory;
+	out_of_memory.type = ErrorType::Lexer_OutOfMemory;
+	out_of_memory.offset = edit.offset;
+
+	bool keep_trivia = stream->trivia_starts.len() > 0;
+	isize before = tokens_before(*stream, edit.offset);
+	isize first = max(isize(0), before - 1);
+	isize restart = 0;
+	if(keep_trivia){
+		restart = stream->trivia_start(first); /* Restart with the trivia, its start is recorded again */
+	} else {
+		restart = before > 0 ? stream->offset(first) : 0; /* Leading trivia may be edited */
+	}
+
+	// Tokens before the gap keep their offsets through the edit, the ones
+	// after it are counted from the end of the text and shift with it
+	move_token_gap(stream, before);
+
+	if(!reserve_text(stream, edit.inserted.len())){
+		return out_of_memory;
+	}
+	move_text_gap(stream, edit.offset);
+
+	// The removed bytes are kept to undo the edit when lexing fails
+	isize removed_at = edit.offset + (stream->source.len() - stream->text_len);
+	auto removed = DynamicArray<byte>::create(heap_allocator(), edit.removed + 1);
+	removed.append(stream->source[{removed_at, removed_at + edit.removed}]);
+	if(removed.len() != edit.removed){
+		return out_of_memory;
+	}
+	replace_text(stream, edit.removed, edit.inserted);
+
+	auto undo = [&](){
+		move_text_gap(stream, edit.offset);
+		replace_text(stream, edit.inserted.len(), Slice<byte>(removed.data(), removed.len()));
+		move_text_gap(stream, restart);
+	};
+
+	// Lexing restarts at the gap, so the text it reads is contiguous
+	move_text_gap(stream, restart);
+	isize tail_start = restart + (stream->source.len() - stream->text_len);
+
+	auto types   = DynamicArray<u8>::create(heap_allocator(), 64);
+	auto offsets = DynamicArray<u32>::create(heap_allocator(), 64);
+	DynamicArray<u32> trivia_starts;
+	if(keep_trivia){
+		trivia_starts = DynamicArray<u32>::create(heap_allocator(), 64);
+	}
+
+	// Errors are recovered from here rather than in the lexer, so they are
+	// recorded with offsets in the whole text
+	auto lex = Lexer::create(String::from_bytes(stream->source[{tail_start, stream->source.len()}]));
+	lex.scratch = thread_arena();
+	lex.trivia = stream->trivia;
+
+	isize old_end = stream->count;
+	isize next_old = before;
+	isize trivia_start = 0;
+	for(;;){
+		trivia_start = restart + lex.current;
+		if(stream->trivia == TriviaMode::Skip){
+			lex.skip_trivia();
+		}
+		isize start = restart + lex.current;
+
+		// Past the edit the text is the old one shifted by `delta`, as are
+		// the old tokens after the gap. Once a token starts where an old one
+		// does the rest of the old stream follows.
+		if(start >= new_tail){
+			while(next_old < stream->count && isize(stream->offset(next_old)) < start){ next_old += 1; }
+			if(next_old < stream->count && isize(stream->offset(next_old)) == start){
+				old_end = next_old;
+				break;
+			}
+		}
+
+		Token token;
+		auto res = next_discarding_value(&lex);
+		if(res.ok()){
+			token = res.unwrap();
+		}
+		else {
+			Error e = res.unwrap_error();
+			bool recovered = errors != nullptr && lex.synchronize(e);
+			e.offset += restart;
+			if(!recovered){
+				undo();
+				return e;
+			}
+			if(!errors->append(e)){
+				undo();
+				return out_of_memory;
+			}
+			token = lex.make_token(TokenType::Unknown);
+		}
+
+		// Leading tokens that ended before the edit could be seen are the old ones
+		bool unchanged = types.len() == 0 && first < before
+			&& isize(stream->offset(first)) == start && stream->type(first) == token.type
+			&& restart + token.offset + lookahead <= edit.offset;
+		if(unchanged){
+			first += 1;
+			continue;
+		}
+
+		types.append(u8(token.type));
+		offsets.append(u32(start));
+		if(keep_trivia){
+			trivia_starts.append(u32(trivia_start));
+		}
+		if(token.type == TokenType::EndOfFile){ break; }
+	}
+
+	isize added = types.len();
+	isize count = stream->count - (old_end - first) + added;
+	if(offsets.len() != added || (keep_trivia && trivia_starts.len() != added) || !reserve_tokens(stream, count)){
+		undo();
+		return out_of_memory;
+	}
+
+	// The new tokens replace the old ones from `first` on, before the gap, the
+	// old ones up to `old_end` drop out after it
+	mem_copy_no_overlap(stream->types.data() + first, types.data(), added * sizeof(u8));
+	mem_copy_no_overlap(stream->offsets.data() + first, offsets.data(), added * sizeof(u32));
+	if(keep_trivia){
+		mem_copy_no_overlap(stream->trivia_starts.data() + first, trivia_starts.data(), added * sizeof(u32));
+	}
+	stream->gap   = first + added;
+	stream->count = count;
+
+	// The trivia in front of the first reused token may have been edited
+	if(keep_trivia && stream->gap < count){
+		stream->trivia_starts[stream->gap + (stream->trivia_starts.len() - count)] = u32(stream->text_len - trivia_start);
+	}
+
+	stream->literal_tokens = {};
+	stream->literal_values = {};
+	stream->lines = LineIndex{};
+
+	Relexed result;
+	result.first   = first;
+	result.old_end = old_end;
+	result.new_end = first + added;
+	return result;
+}
+
+} /* Namespace */
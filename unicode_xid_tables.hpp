@@ -0,0 +1,500 @@
+#pragma once
+
+// XID_Start and XID_Continue from Unicode 14.0.0 as three level bitmaps:
+// `root` maps each block of 4096 codepoints to a row of `mids`, which maps
+// each run of 128 codepoints to a 128-bit leaf in `leaves`. Identical rows
+// and leaves are shared. Generated with:
+//
+//   xid_start(c)    = chr(c).isidentifier() and c != "_"
+//   xid_continue(c) = ("a" + chr(c)).isidentifier()
+//   split [0, 225 * 4096) into 128 bit leaves and 32 leaf rows, deduplicate
+
+namespace kielo {
+struct XidTable {
+	core::u8  const* root;
+	core::u8  const (*mids)[32];
+	core::u64 const (*leaves)[2];
+};
+
+constexpr core::i32 xid_table_limit = 225 << 12;
+
+constexpr core::u8 xid_start_root[225] = {
+	0, 1, 2, 3, 4, 5, 5, 5, 5, 5, 6, 5, 5, 7, 8, 9,
+	10, 11, 12, 13, 14, 8, 15, 5, 16, 8, 17, 18, 8, 19, 20, 8,
+	5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 21, 22, 23, 5, 24, 25,
+	5, 26, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8,
+};
+
+constexpr core::u8 xid_start_mids[27][32] = {
+	{0, 1, 2, 2, 2, 3, 4, 5, 2, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28},
+	{29, 30, 2, 2, 31, 32, 33, 34, 35, 2, 2, 2, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 2, 50, 2, 2, 51, 52},
+	{53, 54, 55, 56, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 2, 58, 59, 60, 57, 57, 57, 57},
+	{61, 62, 63, 64, 57, 57, 57, 57, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 50, 2, 2, 2, 2},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 65, 2, 2, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 2, 2, 2, 2, 2, 2, 2, 2},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 78, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57},
+	{57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57},
+	{57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 2, 2, 79, 80, 81, 82, 83, 2, 84, 85, 86, 87, 88, 89},
+	{90, 91, 92, 57, 57, 93, 94, 95, 2, 96, 97, 98, 2, 2, 99, 100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111, 57, 57, 112, 113, 114},
+	{115, 116, 117, 118, 119, 120, 121, 57, 122, 123, 57, 124, 125, 126, 127, 57, 128, 129, 130, 131, 132, 133, 57, 57, 134, 135, 136, 137, 57, 138, 57, 139},
+	{2, 2, 2, 2, 2, 2, 2, 140, 141, 2, 142, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 143},
+	{2, 2, 2, 2, 2, 2, 2, 2, 144, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57},
+	{57, 57, 57, 57, 57, 57, 57, 57, 2, 2, 2, 2, 145, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57},
+	{57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 2, 2, 2, 2, 146, 147, 148, 135, 57, 57, 57, 57, 149, 57, 150, 151},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 152, 2, 2, 2, 2, 2, 2, 2, 2, 2, 153, 56, 57, 57, 57, 57, 57},
+	{57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 154},
+	{2, 2, 155, 2, 2, 156, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 157, 158, 57, 57, 57, 57, 57, 57},
+	{57, 57, 57, 57, 57, 57, 57, 57, 159, 160, 161, 2, 2, 162, 163, 164, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 165, 57},
+	{57, 57, 166, 57, 57, 167, 57, 57, 57, 57, 57, 57, 57, 57, 57, 168, 2, 169, 170, 57, 57, 57, 57, 57, 57, 57, 57, 57, 171, 172, 57, 57},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 173, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 174, 2, 175, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 176, 2, 2},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 177, 57, 57, 57, 57, 57, 57, 57, 57},
+	{57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 2, 2, 2, 2, 178, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57},
+	{2, 2, 2, 2, 2, 2, 179, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57, 57},
+};
+
+constexpr core::u64 xid_start_leaves[180][2] = {
+	{0x0000000000000000, 0x07fffffe07fffffe},
+	{0x0420040000000000, 0xff7fffffff7fffff},
+	{0xffffffffffffffff, 0xffffffffffffffff},
+	{0xffffffffffffffff, 0x0000501f0003ffc3},
+	{0x0000000000000000, 0xb8df000000000000},
+	{0xfffffffbffffd740, 0xffbfffffffffffff},
+	{0xfffffffffffffc03, 0xffffffffffffffff},
+	{0xfffeffffffffffff, 0xffffffff027fffff},
+	{0x00000000000001ff, 0x000787ffffff0000},
+	{0xffffffff00000000, 0xfffec000000007ff},
+	{0xffffffffffffffff, 0x9c00c060002fffff},
+	{0x0000fffffffd0000, 0xffffffffffffe000},
+	{0x0002003fffffffff, 0x043007fffffffc00},
+	{0x00000110043fffff, 0xffff07ff01ffffff},
+	{0xffffffff00007eff, 0x00000000000003ff},
+	{0x23fffffffffffff0, 0xfffe0003ff010000},
+	{0x23c5fdfffff99fe1, 0x10030003b0004000},
+	{0x036dfdfffff987e0, 0x001c00005e000000},
+	{0x23edfdfffffbbfe0, 0x0200000300010000},
+	{0x23edfdfffff99fe0, 0x00020003b0000000},
+	{0x03ffc718d63dc7e8, 0x0000000000010000},
+	{0x23fffdfffffddfe0, 0x0000000327000000},
+	{0x23effdfffffddfe1, 0x0006000360000000},
+	{0x27fffffffffddff0, 0xfc00000380704000},
+	{0x2ffbfffffc7fffe0, 0x000000000000007f},
+	{0x0005fffffffffffe, 0x000000000000007f},
+	{0x2005ffaffffff7d6, 0x00000000f000005f},
+	{0x0000000000000001, 0x00001ffffffffeff},
+	{0x0000000000001f00, 0x0000000000000000},
+	{0x800007ffffffffff, 0xffe1c0623c3f0000},
+	{0xffffffff00004003, 0xf7ffffffffff20bf},
+	{0xffffffffffffffff, 0xffffffff3d7f3dff},
+	{0x7f3dffffffff3dff, 0xffffffffff7fff3d},
+	{0xffffffffff3dffff, 0x0000000007ffffff},
+	{0xffffffff0000ffff, 0x3f3fffffffffffff},
+	{0xfffffffffffffffe, 0xffffffffffffffff},
+	{0xffffffffffffffff, 0xffff9fffffffffff},
+	{0xffffffff07fffffe, 0x01ffc7ffffffffff},
+	{0x0003ffff8003ffff, 0x0001dfff0003ffff},
+	{0x000fffffffffffff, 0x0000000010800000},
+	{0xffffffff00000000, 0x01ffffffffffffff},
+	{0xffff05ffffffffff, 0x003fffffffffffff},
+	{0x000000007fffffff, 0x001f3fffffff0000},
+	{0xffff0fffffffffff, 0x00000000000003ff},
+	{0xffffffff007fffff, 0x00000000001fffff},
+	{0x0000008000000000, 0x0000000000000000},
+	{0x000fffffffffffe0, 0x0000000000001fe0},
+	{0xfc00c001fffffff8, 0x0000003fffffffff},
+	{0x0000000fffffffff, 0x3ffffffffc00e000},
+	{0xe7ffffffffff01ff, 0x046fde0000000000},
+	{0xffffffffffffffff, 0x0000000000000000},
+	{0xffffffff3f3fffff, 0x3fffffffaaff3f3f},
+	{0x5fdfffffffffffff, 0x1fdc1fff0fcf1fdc},
+	{0x0000000000000000, 0x8002000000000000},
+	{0x000000001fff0000, 0x0000000000000000},
+	{0xf3fffd503f2ffc84, 0xffffffff000043e0},
+	{0x00000000000001ff, 0x0000000000000000},
+	{0x0000000000000000, 0x0000000000000000},
+	{0xffffffffffffffff, 0x000c781fffffffff},
+	{0xffff20bfffffffff, 0x000080ffffffffff},
+	{0x7f7f7f7f007fffff, 0x000000007f7f7f7f},
+	{0x1f3e03fe000000e0, 0xfffffffffffffffe},
+	{0xfffffffee07fffff, 0xf7ffffffffffffff},
+	{0xfffeffffffffffe0, 0xffffffffffffffff},
+	{0xffffffff00007fff, 0xffff000000000000},
+	{0x0000000000001fff, 0x3fffffffffff0000},
+	{0x00000c00ffff1fff, 0x80007fffffffffff},
+	{0xffffffff3fffffff, 0x0000ffffffffffff},
+	{0xfffffffcff800000, 0xffffffffffffffff},
+	{0xfffffffffffff9ff, 0xfffc000003eb07ff},
+	{0x00000007fffff7bb, 0x000fffffffffffff},
+	{0x000ffffffffffffc, 0x68fc000000000000},
+	{0xffff003ffffffc00, 0x1fffffff0000007f},
+	{0x0007fffffffffff0, 0x7c00ffdf00008000},
+	{0x000001ffffffffff, 0xc47fffff00000ff7},
+	{0x3e62ffffffffffff, 0x001c07ff38000005},
+	{0xffff7f7f007e7e7e, 0xffff03fff7ffffff},
+	{0xffffffffffffffff, 0x00000007ffffffff},
+	{0xffff000fffffffff, 0x0ffffffffffff87f},
+	{0xffffffffffffffff, 0xffff3fffffffffff},
+	{0xffffffffffffffff, 0x0000000003ffffff},
+	{0x5f7ffdffa0f8007f, 0xffffffffffffffdb},
+	{0x0003ffffffffffff, 0xfffffffffff80000},
+	{0xffffffffffffffff, 0xfffffff03fffffff},
+	{0x3fffffffffffffff, 0xffffffffffff0000},
+	{0xfffffffffffcffff, 0x03ff0000000000ff},
+	{0x0000000000000000, 0xaa8a000000000000},
+	{0xffffffffffffffff, 0x1fffffffffffffff},
+	{0x07fffffe00000000, 0xffffffc007fffffe},
+	{0x7fffffff3fffffff, 0x000000001cfcfcfc},
+	{0xb7ffff7fffffefff, 0x000000003fff3fff},
+	{0xffffffffffffffff, 0x07ffffffffffffff},
+	{0x0000000000000000, 0x001fffffffffffff},
+	{0xffffffff1fffffff, 0x000000000001ffff},
+	{0xffffe000ffffffff, 0x003fffffffff07ff},
+	{0xffffffff3fffffff, 0x00000000003eff0f},
+	{0xffff00003fffffff, 0x0fffffffff0fffff},
+	{0xffff00ffffffffff, 0xf7ff000fffffffff},
+	{0x1bfbfffbffb7f7ff, 0x0000000000000000},
+	{0x007fffffffffffff, 0x000000ff003fffff},
+	{0x07fdffffffffffbf, 0x0000000000000000},
+	{0x91bffffffffffd3f, 0x007fffff003fffff},
+	{0x000000007fffffff, 0x0037ffff00000000},
+	{0x03ffffff003fffff, 0x0000000000000000},
+	{0xc0ffffffffffffff, 0x0000000000000000},
+	{0x003ffffffeef0001, 0x1fffffff00000000},
+	{0x000000001fffffff, 0x0000001ffffffeff},
+	{0x003fffffffffffff, 0x0007ffff003fffff},
+	{0x000000000003ffff, 0x0000000000000000},
+	{0xffffffffffffffff, 0x00000000000001ff},
+	{0x0007ffffffffffff, 0x0007ffffffffffff},
+	{0x0000000fffffffff, 0x0000000000000000},
+	{0x000303ffffffffff, 0x0000000000000000},
+	{0xffff00801fffffff, 0xffff00000000003f},
+	{0xffff000000000003, 0x007fffff0000001f},
+	{0x00fffffffffffff8, 0x0026000000000000},
+	{0x0000fffffffffff8, 0x000001ffffff0000},
+	{0x0000007ffffffff8, 0x0047ffffffff0090},
+	{0x0007fffffffffff8, 0x000000001400001e},
+	{0x00000ffffffbffff, 0x0000000000000000},
+	{0xffff01ffbfffbd7f, 0x000000007fffffff},
+	{0x23edfdfffff99fe0, 0x00000003e0010000},
+	{0x001fffffffffffff, 0x0000000380000780},
+	{0x0000ffffffffffff, 0x00000000000000b0},
+	{0x00007fffffffffff, 0x000000000f000000},
+	{0x0000ffffffffffff, 0x0000000000000010},
+	{0x010007ffffffffff, 0x0000000000000000},
+	{0x0000000007ffffff, 0x000000000000007f},
+	{0x00000fffffffffff, 0x0000000000000000},
+	{0xffffffff00000000, 0x80000000ffffffff},
+	{0x8000ffffff6ff27f, 0x0000000000000002},
+	{0xfffffcff00000000, 0x0000000a0001ffff},
+	{0x0407fffffffff801, 0xfffffffff0010000},
+	{0xffff0000200003ff, 0x01ffffffffffffff},
+	{0x00007ffffffffdff, 0xfffc000000000001},
+	{0x000000000000ffff, 0x0000000000000000},
+	{0x0001fffffffffb7f, 0xfffffdbf00000040},
+	{0x00000000010003ff, 0x0000000000000000},
+	{0x0000000000000000, 0x0007ffff00000000},
+	{0x0001000000000000, 0x0000000000000000},
+	{0x0000000003ffffff, 0x0000000000000000},
+	{0xffffffffffffffff, 0x00007fffffffffff},
+	{0xffffffffffffffff, 0x000000000000000f},
+	{0xffffffffffff0000, 0x0001ffffffffffff},
+	{0x00007fffffffffff, 0x0000000000000000},
+	{0xffffffffffffffff, 0x000000000000007f},
+	{0x01ffffffffffffff, 0xffff00007fffffff},
+	{0x7fffffffffffffff, 0x00003fffffff0000},
+	{0x0000ffffffffffff, 0xe0fffff80000000f},
+	{0x0000000000000000, 0xffffffffffffffff},
+	{0xffffffffffffffff, 0x00000000000107ff},
+	{0x00000000fff80000, 0x0000000b00000000},
+	{0xffffffffffffffff, 0x00ffffffffffffff},
+	{0xffffffffffffffff, 0x00000000003fffff},
+	{0x0000000000000000, 0x6fef000000000000},
+	{0x00000007ffffffff, 0xffff00f000070000},
+	{0xffffffffffffffff, 0x0fffffffffffffff},
+	{0xffffffffffffffff, 0x1fff07ffffffffff},
+	{0x0000000003ff01ff, 0x0000000000000000},
+	{0xffffffffffffffff, 0xffffffffffdfffff},
+	{0xebffde64dfffffff, 0xffffffffffffffef},
+	{0x7bffffffdfdfe7bf, 0xfffffffffffdfc5f},
+	{0xffffff3fffffffff, 0xf7fffffff7fffffd},
+	{0xffdfffffffdfffff, 0xffff7fffffff7fff},
+	{0xfffffdfffffffdff, 0x0000000000000ff7},
+	{0x000000007fffffff, 0x0000000000000000},
+	{0x3f801fffffffffff, 0x0000000000004000},
+	{0x00003fffffff0000, 0x00000fffffffffff},
+	{0x0000000000000000, 0x7fff6f7f00000000},
+	{0xffffffffffffffff, 0x000000000000001f},
+	{0xffffffffffffffff, 0x000000000000080f},
+	{0x0af7fe96ffffffef, 0x5ef7f796aa96ea84},
+	{0x0ffffbee0ffffbff, 0x0000000000000000},
+	{0xffffffffffffffff, 0x00000000ffffffff},
+	{0x01ffffffffffffff, 0xffffffffffffffff},
+	{0xffffffff3fffffff, 0xffffffffffffffff},
+	{0xffff0003ffffffff, 0xffffffffffffffff},
+	{0xffffffffffffffff, 0x00000001ffffffff},
+	{0x000000003fffffff, 0x0000000000000000},
+	{0xffffffffffffffff, 0x00000000000007ff},
+};
+
+constexpr XidTable xid_start_table = { xid_start_root, xid_start_mids, xid_start_leaves };
+
+constexpr core::u8 xid_continue_root[225] = {
+	0, 1, 2, 3, 4, 5, 5, 5, 5, 5, 6, 5, 5, 7, 8, 9,
+	10, 11, 12, 13, 14, 8, 15, 5, 16, 8, 17, 18, 19, 20, 21, 22,
+	5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 23, 24, 25, 5, 26, 27,
+	5, 28, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+	29,
+};
+
+constexpr core::u8 xid_continue_mids[30][32] = {
+	{0, 1, 2, 2, 2, 3, 4, 5, 2, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28},
+	{29, 30, 2, 2, 31, 32, 33, 34, 35, 2, 2, 2, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 2, 2, 2, 2, 50, 51},
+	{52, 53, 54, 55, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 2, 57, 58, 59, 56, 56, 56, 56},
+	{60, 61, 62, 63, 56, 56, 56, 56, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 64, 2, 2, 2, 2},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 65, 2, 2, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 2, 2, 2, 2, 2, 2, 2, 2},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 78, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56},
+	{56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56},
+	{56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 2, 2, 79, 80, 81, 82, 83, 2, 84, 85, 86, 87, 88, 89},
+	{90, 91, 92, 93, 56, 94, 95, 96, 2, 97, 98, 99, 2, 2, 100, 101, 102, 103, 104, 105, 106, 107, 108, 109, 110, 111, 112, 56, 56, 113, 114, 115},
+	{116, 117, 118, 119, 120, 121, 122, 56, 123, 124, 56, 125, 126, 127, 128, 56, 129, 130, 131, 132, 133, 134, 56, 56, 135, 136, 137, 138, 56, 139, 56, 140},
+	{2, 2, 2, 2, 2, 2, 2, 141, 142, 2, 143, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 144},
+	{2, 2, 2, 2, 2, 2, 2, 2, 145, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56},
+	{56, 56, 56, 56, 56, 56, 56, 56, 2, 2, 2, 2, 146, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56},
+	{56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 2, 2, 2, 2, 147, 148, 149, 150, 56, 56, 56, 56, 151, 56, 152, 153},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 154, 2, 2, 2, 2, 2, 2, 2, 2, 2, 155, 55, 56, 56, 56, 56, 56},
+	{56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 156},
+	{2, 2, 157, 2, 2, 158, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 159, 160, 56, 56, 56, 56, 56, 56},
+	{56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 161, 56},
+	{56, 56, 162, 163, 164, 56, 56, 56, 165, 166, 167, 2, 2, 168, 169, 170, 56, 56, 56, 56, 171, 172, 56, 56, 56, 56, 56, 56, 56, 56, 173, 56},
+	{174, 56, 175, 56, 56, 176, 56, 56, 56, 56, 56, 56, 56, 56, 56, 177, 2, 178, 179, 56, 56, 56, 56, 56, 56, 56, 56, 56, 180, 181, 56, 56},
+	{56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 182, 56, 56, 56, 56, 56, 56, 56, 56},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 183, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 184, 2, 185, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 186, 2, 2},
+	{2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 187, 56, 56, 56, 56, 56, 56, 56, 56},
+	{56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 2, 2, 2, 2, 188, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56},
+	{2, 2, 2, 2, 2, 2, 189, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56},
+	{56, 56, 2, 190, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56, 56},
+};
+
+constexpr core::u64 xid_continue_leaves[191][2] = {
+	{0x03ff000000000000, 0x07fffffe87fffffe},
+	{0x04a0040000000000, 0xff7fffffff7fffff},
+	{0xffffffffffffffff, 0xffffffffffffffff},
+	{0xffffffffffffffff, 0x0000501f0003ffc3},
+	{0xffffffffffffffff, 0xb8dfffffffffffff},
+	{0xfffffffbffffd7c0, 0xffbfffffffffffff},
+	{0xfffffffffffffcfb, 0xffffffffffffffff},
+	{0xfffeffffffffffff, 0xffffffff027fffff},
+	{0xbffffffffffe01ff, 0x000787ffffff00b6},
+	{0xffffffff07ff0000, 0xffffc3ffffffffff},
+	{0xffffffffffffffff, 0x9ffffdff9fefffff},
+	{0xffffffffffff0000, 0xffffffffffffe7ff},
+	{0x0003ffffffffffff, 0x243fffffffffffff},
+	{0x00003fffffffffff, 0xffff07ff0fffffff},
+	{0xffffffffff007eff, 0xfffffffbffffffff},
+	{0xffffffffffffffff, 0xfffeffcfffffffff},
+	{0xf3c5fdfffff99fef, 0x5003ffcfb080799f},
+	{0xd36dfdfffff987ee, 0x003fffc05e023987},
+	{0xf3edfdfffffbbfee, 0xfe00ffcf00013bbf},
+	{0xf3edfdfffff99fee, 0x0002ffcfb0e0399f},
+	{0xc3ffc718d63dc7ec, 0x0000ffc000813dc7},
+	{0xf3fffdfffffddfff, 0x0000ffcf27603ddf},
+	{0xf3effdfffffddfef, 0x0006ffcf60603ddf},
+	{0xfffffffffffddfff, 0xfc00ffcf80f07ddf},
+	{0x2ffbfffffc7fffee, 0x000cffc0ff5f847f},
+	{0x07fffffffffffffe, 0x0000000003ff7fff},
+	{0x3fffffaffffff7d6, 0x00000000f3ff3f5f},
+	{0xc2a003ff03000001, 0xfffe1ffffffffeff},
+	{0x1ffffffffeffffdf, 0x0000000000000040},
+	{0xffffffffffffffff, 0xffffffffffff03ff},
+	{0xffffffff3fffffff, 0xf7ffffffffff20bf},
+	{0xffffffffffffffff, 0xffffffff3d7f3dff},
+	{0x7f3dffffffff3dff, 0xffffffffff7fff3d},
+	{0xffffffffff3dffff, 0x0003fe00e7ffffff},
+	{0xffffffff0000ffff, 0x3f3fffffffffffff},
+	{0xfffffffffffffffe, 0xffffffffffffffff},
+	{0xffffffffffffffff, 0xffff9fffffffffff},
+	{0xffffffff07fffffe, 0x01ffc7ffffffffff},
+	{0x001fffff803fffff, 0x000ddfff000fffff},
+	{0xffffffffffffffff, 0x000003ff308fffff},
+	{0xffffffff03ffb800, 0x01ffffffffffffff},
+	{0xffff07ffffffffff, 0x003fffffffffffff},
+	{0x0fff0fff7fffffff, 0x001f3fffffffffc0},
+	{0xffff0fffffffffff, 0x0000000007ff03ff},
+	{0xffffffff0fffffff, 0x9fffffff7fffffff},
+	{0xbfff008003ff03ff, 0x0000000000007fff},
+	{0xffffffffffffffff, 0x000ff80003ff1fff},
+	{0xffffffffffffffff, 0x000fffffffffffff},
+	{0x00ffffffffffffff, 0x3fffffffffffe3ff},
+	{0xe7ffffffffff01ff, 0x07fffffffff70000},
+	{0xffffffff3f3fffff, 0x3fffffffaaff3f3f},
+	{0x5fdfffffffffffff, 0x1fdc1fff0fcf1fdc},
+	{0x8000000000000000, 0x8002000000100001},
+	{0x000000001fff0000, 0x0001ffe21fff0000},
+	{0xf3fffd503f2ffc84, 0xffffffff000043e0},
+	{0x00000000000001ff, 0x0000000000000000},
+	{0x0000000000000000, 0x0000000000000000},
+	{0xffffffffffffffff, 0x000ff81fffffffff},
+	{0xffff20bfffffffff, 0x800080ffffffffff},
+	{0x7f7f7f7f007fffff, 0xffffffff7f7f7f7f},
+	{0x1f3efffe000000e0, 0xfffffffffffffffe},
+	{0xfffffffee67fffff, 0xf7ffffffffffffff},
+	{0xfffeffffffffffe0, 0xffffffffffffffff},
+	{0xffffffff00007fff, 0xffff000000000000},
+	{0xffffffffffffffff, 0x0000000000000000},
+	{0x0000000000001fff, 0x3fffffffffff0000},
+	{0x00000fffffff1fff, 0xbff0ffffffffffff},
+	{0xffffffffffffffff, 0x0003ffffffffffff},
+	{0xfffffffcff800000, 0xffffffffffffffff},
+	{0xfffffffffffff9ff, 0xfffc000003eb07ff},
+	{0x000010ffffffffff, 0x000fffffffffffff},
+	{0xffffffffffffffff, 0xe8ffffff03ff003f},
+	{0xffff3fffffffffff, 0x1fffffff000fffff},
+	{0xffffffffffffffff, 0x7fffffff03ff8001},
+	{0x007fffffffffffff, 0xfc7fffff03ff3fff},
+	{0xffffffffffffffff, 0x007cffff38000007},
+	{0xffff7f7f007e7e7e, 0xffff03fff7ffffff},
+	{0xffffffffffffffff, 0x03ff37ffffffffff},
+	{0xffff000fffffffff, 0x0ffffffffffff87f},
+	{0xffffffffffffffff, 0xffff3fffffffffff},
+	{0xffffffffffffffff, 0x0000000003ffffff},
+	{0x5f7ffdffe0f8007f, 0xffffffffffffffdb},
+	{0x0003ffffffffffff, 0xfffffffffff80000},
+	{0xffffffffffffffff, 0xfffffff03fffffff},
+	{0x3fffffffffffffff, 0xffffffffffff0000},
+	{0xfffffffffffcffff, 0x03ff0000000000ff},
+	{0x0018ffff0000ffff, 0xaa8a00000000e000},
+	{0xffffffffffffffff, 0x1fffffffffffffff},
+	{0x87fffffe03ff0000, 0xffffffc007fffffe},
+	{0x7fffffffffffffff, 0x000000001cfcfcfc},
+	{0xb7ffff7fffffefff, 0x000000003fff3fff},
+	{0xffffffffffffffff, 0x07ffffffffffffff},
+	{0x0000000000000000, 0x001fffffffffffff},
+	{0x0000000000000000, 0x2000000000000000},
+	{0xffffffff1fffffff, 0x000000010001ffff},
+	{0xffffe000ffffffff, 0x07ffffffffff07ff},
+	{0xffffffff3fffffff, 0x00000000003eff0f},
+	{0xffff03ff3fffffff, 0x0fffffffff0fffff},
+	{0xffff00ffffffffff, 0xf7ff000fffffffff},
+	{0x1bfbfffbffb7f7ff, 0x0000000000000000},
+	{0x007fffffffffffff, 0x000000ff003fffff},
+	{0x07fdffffffffffbf, 0x0000000000000000},
+	{0x91bffffffffffd3f, 0x007fffff003fffff},
+	{0x000000007fffffff, 0x0037ffff00000000},
+	{0x03ffffff003fffff, 0x0000000000000000},
+	{0xc0ffffffffffffff, 0x0000000000000000},
+	{0x873ffffffeeff06f, 0x1fffffff00000000},
+	{0x000000001fffffff, 0x0000007ffffffeff},
+	{0x003fffffffffffff, 0x0007ffff003fffff},
+	{0x000000000003ffff, 0x0000000000000000},
+	{0xffffffffffffffff, 0x00000000000001ff},
+	{0x0007ffffffffffff, 0x0007ffffffffffff},
+	{0x03ff00ffffffffff, 0x0000000000000000},
+	{0x00031bffffffffff, 0x0000000000000000},
+	{0xffff00801fffffff, 0xffff00000001ffff},
+	{0xffff00000000003f, 0x007fffff0000001f},
+	{0xffffffffffffffff, 0x803fffc00000007f},
+	{0x07ffffffffffffff, 0x03ff01ffffff0004},
+	{0xffdfffffffffffff, 0x004fffffffff00f0},
+	{0xffffffffffffffff, 0x0000000017ffde1f},
+	{0x40fffffffffbffff, 0x0000000000000000},
+	{0xffff01ffbfffbd7f, 0x03ff07ffffffffff},
+	{0xfbedfdfffff99fef, 0x001f1fcfe081399f},
+	{0xffffffffffffffff, 0x00000003c3ff07ff},
+	{0xffffffffffffffff, 0x0000000003ff00bf},
+	{0xff3fffffffffffff, 0x000000003f000001},
+	{0xffffffffffffffff, 0x0000000003ff0011},
+	{0x01ffffffffffffff, 0x00000000000003ff},
+	{0x03ff0fffe7ffffff, 0x000000000000007f},
+	{0x07ffffffffffffff, 0x0000000000000000},
+	{0xffffffff00000000, 0x800003ffffffffff},
+	{0xf9bfffffff6ff27f, 0x0000000003ff000f},
+	{0xfffffcff00000000, 0x0000001bfcffffff},
+	{0x7fffffffffffffff, 0xffffffffffff0080},
+	{0xffff000023ffffff, 0x01ffffffffffffff},
+	{0xff7ffffffffffdff, 0xfffc000003ff0001},
+	{0x007ffefffffcffff, 0x0000000000000000},
+	{0xb47ffffffffffb7f, 0xfffffdbf03ff00ff},
+	{0x000003ff01fb7fff, 0x0000000000000000},
+	{0x0000000000000000, 0x007fffff00000000},
+	{0x0001000000000000, 0x0000000000000000},
+	{0x0000000003ffffff, 0x0000000000000000},
+	{0xffffffffffffffff, 0x00007fffffffffff},
+	{0xffffffffffffffff, 0x000000000000000f},
+	{0xffffffffffff0000, 0x0001ffffffffffff},
+	{0x00007fffffffffff, 0x0000000000000000},
+	{0xffffffffffffffff, 0x000000000000007f},
+	{0x01ffffffffffffff, 0xffff03ff7fffffff},
+	{0x7fffffffffffffff, 0x001f3fffffff03ff},
+	{0x007fffffffffffff, 0xe0fffff803ff000f},
+	{0x000000000000ffff, 0x0000000000000000},
+	{0x0000000000000000, 0xffffffffffffffff},
+	{0xffffffffffffffff, 0xffffffffffff87ff},
+	{0x00000000ffff80ff, 0x0003001b00000000},
+	{0xffffffffffffffff, 0x00ffffffffffffff},
+	{0xffffffffffffffff, 0x00000000003fffff},
+	{0x0000000000000000, 0x6fef000000000000},
+	{0x00000007ffffffff, 0xffff00f000070000},
+	{0xffffffffffffffff, 0x0fffffffffffffff},
+	{0xffffffffffffffff, 0x1fff07ffffffffff},
+	{0x0000000063ff01ff, 0x0000000000000000},
+	{0xffff3fffffffffff, 0x000000000000007f},
+	{0x0000000000000000, 0xf807e3e000000000},
+	{0x00003c0000000fe7, 0x0000000000000000},
+	{0x0000000000000000, 0x000000000000001c},
+	{0xffffffffffffffff, 0xffffffffffdfffff},
+	{0xebffde64dfffffff, 0xffffffffffffffef},
+	{0x7bffffffdfdfe7bf, 0xfffffffffffdfc5f},
+	{0xffffff3fffffffff, 0xf7fffffff7fffffd},
+	{0xffdfffffffdfffff, 0xffff7fffffff7fff},
+	{0xfffffdfffffffdff, 0xffffffffffffcff7},
+	{0xf87fffffffffffff, 0x00201fffffffffff},
+	{0x0000fffef8000010, 0x0000000000000000},
+	{0x000000007fffffff, 0x0000000000000000},
+	{0x000007dbf9ffff7f, 0x0000000000000000},
+	{0x3fff1fffffffffff, 0x00000000000043ff},
+	{0x00007fffffff0000, 0x03ffffffffffffff},
+	{0x0000000000000000, 0x7fff6f7f00000000},
+	{0xffffffffffffffff, 0x00000000007f001f},
+	{0xffffffffffffffff, 0x0000000003ff0fff},
+	{0x0af7fe96ffffffef, 0x5ef7f796aa96ea84},
+	{0x0ffffbee0ffffbff, 0x0000000000000000},
+	{0x0000000000000000, 0x03ff000000000000},
+	{0xffffffffffffffff, 0x00000000ffffffff},
+	{0x01ffffffffffffff, 0xffffffffffffffff},
+	{0xffffffff3fffffff, 0xffffffffffffffff},
+	{0xffff0003ffffffff, 0xffffffffffffffff},
+	{0xffffffffffffffff, 0x00000001ffffffff},
+	{0x000000003fffffff, 0x0000000000000000},
+	{0xffffffffffffffff, 0x00000000000007ff},
+	{0xffffffffffffffff, 0x0000ffffffffffff},
+};
+
+constexpr XidTable xid_continue_table = { xid_continue_root, xid_continue_mids, xid_continue_leaves };
+}